@@ -3,6 +3,7 @@
 /***********************************************************************************/
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,6 +11,8 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
 #include <util/delay.h>
 #include <cpu_speed.h>
 #include <graphics.h>
@@ -18,6 +21,8 @@
 #include <macros.h>
 #include <lcd_model.h>
 #include "usb_serial.h"
+#include "zombie_race.h"
+#include "levels.h"     // Made from levels.txt by levelgen.exe
 
 /***********************************************************************************/
 /* GLOBALS                                                                         */
@@ -27,6 +32,8 @@
 #define TIMER0_PRESCALE     (256.0)     // The prescale we used when setting up Timer0
 #define TIMER1_PRESCALE     (1024.0)    // The prescale we used when setting up Timer3
 #define TIMER1_FREQ         7812
+// Each Timer0 tick lasts TIMER0_PRESCALE/CPU_FREQ = 32us, and it overflows every 256 ticks (8.192ms)
+#define TIMER0_TICK_US      32
 #define DASHBOARD_BORDER_X  26
 
 // The pin numbers for each switch (still need to manually find the port letter)
@@ -38,96 +45,264 @@
 #define STICK_UP            1
 #define STICK_DOWN          7
 
-// Determines the effect of the speed on the objects
+// Determines the effect of the speed on the objects. The speed limits and how fast the
+// speed changes are set by the level (see levels.txt).
 #define SPEED_THRESH        8
 #define SPEED_FACTOR        8
-#define SPEED_MIN           0      
-#define SPEED_MAX           10
-#define SPEED_OFFROAD_MAX   3
+// The world scrolls speed/(SPEED_FACTOR*SPEED_THRESH) pixels each Timer1 tick, which is the speed
+// (Q16.16) shifted down by SCROLL_SHIFT in 1/65536ths of a pixel (see scroll_phase)
+#define SCROLL_SHIFT        6
+#define SCROLL_PIXEL        0x10000UL
+#define SCROLL_MAX_STEPS    2       // The steps one update() can catch up on after a slow frame
+_Static_assert((1 << SCROLL_SHIFT) == SPEED_FACTOR * SPEED_THRESH, "SCROLL_SHIFT doesn't match the speed factors");
 
 // Determines direction of movement of the road
 #define ROAD_LEFT           0
 #define ROAD_RIGHT          1
 #define ROAD_STRAIGHT       2
-// The minimum and maximum curve allowed for the road (see road_curve)
-#define ROAD_CURVE_MIN      2
-#define ROAD_CURVE_MAX      3
-// How many steps the road can take before it has to change directions
-#define ROAD_SECTION_MIN    15
-#define ROAD_SECTION_MAX    35
-
-// The rate at which the fuel decreases
-#define FUEL_FACTOR         3
+// The curves and lengths of the sections of road are set by the level (see levels.txt). The next
+// ROAD_QUEUE_LENGTH sections are made in the time left over at the end of each frame, so road_step()
+// only has to take the next one. Each section takes one number from RANDOM_ROAD, so the same seed
+// always makes the same road however far ahead it has been made.
+
+// The size of the fuel tank (the rate it empties and the distance between fuel stations are
+// set by the level)
 #define FUEL_MAX            100
-#define FUEL_STATION_MIN    140      // The minimum distance the fuel station can spawn
-#define FUEL_STAION_MAX     180
 
 // The different types of obstacles
 #define TERRAIN             0
 #define HAZARD              1
 
-// The different terrain types
-#define NUM_TERRAIN         10
+// The different terrain types (NUM_TERRAIN is in zombie_race.h)
 #define NUM_TERRAIN_TYPES   2
 #define TERRAIN_TREE        0
 #define TERRAIN_SIGN        1
 
-// The different hazard types
-#define NUM_HAZARD          2
+// The different hazard types (NUM_HAZARD is in zombie_race.h). They come after the terrain
+// types in obstacle_images
 #define NUM_HAZARD_TYPES    2
-#define HAZARD_TRIANGLE     0
-#define HAZARD_SPIKE        1
-
-// The chance each step that a hazard that is out of bounds spawns again
-#define HAZARD_SPAWN_CHANCE 15
-
-// Controls - Used to check if any button/joystick has been activated (don't check PINs)
-uint8_t controls_states[7];
-uint8_t prev_controls_states[7];
-
-// Debounce
-uint8_t controls_history[7] = {0};
-
-// Game information
-uint8_t condition;
-double fuel;
-double speed;
-uint8_t distance;
-uint8_t finish_line;
-uint8_t distance_counter;
-double speed_counter;
-bool game_over_loss;
-
-// Game time control
-uint8_t step = 0;
-uint16_t game_timer_counter;
-uint8_t game_paused;
-double time_paused;     // The time the game was paused. Used to avoid the decimal places changing constantly
-                        // when elapsed_time is called during the pause screen due to double division inaccuracies 
+#define HAZARD_TRIANGLE     (NUM_TERRAIN_TYPES + 0)
+#define HAZARD_SPIKE        (NUM_TERRAIN_TYPES + 1)
+#define NUM_OBSTACLE_TYPES  (NUM_TERRAIN_TYPES + NUM_HAZARD_TYPES)
+
+// The terrain and hazards share one obstacle pool (NUM_OBSTACLES and ObstacleMask are in
+// zombie_race.h). The terrain are the first NUM_TERRAIN obstacles and the hazards are the
+// NUM_HAZARD after them.
+#define FIRST_TERRAIN       0
+#define FIRST_HAZARD        NUM_TERRAIN
+#define OBSTACLE_BIT(i)     ((ObstacleMask)1 << (i))
+#define TERRAIN_MASK        ((ObstacleMask)(OBSTACLE_BIT(NUM_TERRAIN) - 1) << FIRST_TERRAIN)
+#define HAZARD_MASK         ((ObstacleMask)(OBSTACLE_BIT(NUM_HAZARD) - 1) << FIRST_HAZARD)
+
+// Broadphase for collisions. The world is split into bands of 8 rows (the same as the LCD banks)
+// and each active obstacle is recorded in every band it covers, so only the obstacles sharing a
+// band with a sprite need their bitmaps checked. Anything above or below the bands is counted as
+// being in the first or last band.
+#define BAND_TOP            (-16)
+#define BAND_HEIGHT         8
+#define NUM_BANDS           ((LCD_Y + 16 - BAND_TOP) / BAND_HEIGHT)
+
+// Incremental LCD rendering. Each of the LCD's 8-row banks is split into spans of columns
+// and a checksum of every span is kept from the last time it was sent to the LCD, so that
+// only the spans that have changed need to be sent over SPI
+#define LCD_BANKS           (LCD_Y / 8)
+#define LCD_SPAN_WIDTH      14
+#define LCD_SPANS           (LCD_X / LCD_SPAN_WIDTH)
+#define LCD_FULL_REFRESH    60      // Frames between full refreshes (recovers from checksum clashes)
+
+// Telemetry. A sample of the game state is taken every TELEMETRY_DIVIDER game steps (0 turns
+// telemetry off). Build with -DTELEMETRY_DIVIDER=n to change how often.
+#ifndef TELEMETRY_DIVIDER
+#define TELEMETRY_DIVIDER   4
+#endif
+#define TELEMETRY_IDLE      0xFF    // telemetry_sending when neither buffer is being sent
+
+// Potentiometers. The ADC converts a channel every Timer0 overflow in the background and the
+// ADC interrupt moves on to the next channel, so each pot is read every 16ms
+#define NUM_ADC_CHANNELS    2
+#define ADC_FILTER_SHIFT    3       // Each sample moves the filtered value 1/8 of the way towards it
+
+// Profiling. Building with PROFILE defined times each phase of the game loop with Timer3, which
+// runs freely at 1MHz (8 cycles a tick), and sends the results to the server every PROFILE_SEND_FRAMES
+#ifdef PROFILE
+#define PROFILE_SEND_FRAMES     60
+#define PROFILE_FRAME_BUDGET    16667   // One frame at 60Hz in microseconds
+#define PROFILE_START(t)        uint16_t t = TCNT3
+#define PROFILE_STOP(phase, t)  profile_record(phase, TCNT3 - (t))
+#define PROFILE_FRAME_END(t)    profile_frame_end(TCNT3 - (t))
+#else
+#define PROFILE_START(t)
+#define PROFILE_STOP(phase, t)
+#define PROFILE_FRAME_END(t)
+#endif
+
+// Replays. Building with RECORD defined sends the seed and the inputs of each update() to the
+// server so the game can be replayed by replay.c (building with HEADLESS defined leaves out
+// main() so replay.c can drive update() itself)
+#define REPLAY_NONE             0xFF    // replay_stop when the recording can carry on
+#ifdef RECORD
+#define REPLAY_RECORD_START()   replay_start()
+#define REPLAY_RECORD_FRAME()   replay_record()
+#define REPLAY_RECORD_STOP(r)   (replay_stop = (r))
+#define REPLAY_RECORD_END()     replay_end()
+#else
+#define REPLAY_RECORD_START()
+#define REPLAY_RECORD_FRAME()
+#define REPLAY_RECORD_STOP(r)
+#define REPLAY_RECORD_END()
+#endif
+
+// Fixed-point numbers used by the physics instead of software emulated doubles.
+// Q8.8 holds values up to +/-127 with a resolution of 1/256, Q16.16 is used where the small
+// per frame rates need the extra precision. FIX8()/FIX16() should only be given constants
+// so that the conversion happens at compile time.
+typedef int16_t fix8_t;
+typedef int32_t fix16_t;
+#define FIX8(x)             ((fix8_t)((x) * 256.0 + 0.5))
+#define FIX16(x)            ((fix16_t)((x) * 65536.0 + ((x) < 0 ? -0.5 : 0.5)))
+#define FIX16_FROM_INT(i)   ((fix16_t)(i) << 16)
+#define FIX8_ROUND(f)       ((int)(((f) + 0x80) >> 8))
+#define FIX16_ROUND(f)      ((int)(((f) + 0x8000L) >> 16))
+
+// Random numbers. Each part of the game draws from its own xorshift stream, so what one part
+// draws doesn't change what the others get, and a range is scaled by multiplying instead of
+// dividing (rand() % n needs a 32-bit step and a software division on the AVR).
+enum RandomStream {
+    RANDOM_ROAD = 0,
+    RANDOM_TERRAIN = 1,
+    RANDOM_HAZARD = 2,
+    RANDOM_FUEL = 3,
+};
+_Static_assert(RANDOM_FUEL + 1 == NUM_RANDOM_STREAMS, "NUM_RANDOM_STREAMS in zombie_race.h doesn't match");
+// What each stream's state is started from, mixed with the seed
+const uint16_t random_stream_keys[NUM_RANDOM_STREAMS] PROGMEM = { 0xACE1, 0x3D29, 0x9B57, 0x64C3 };
+
+// How the speed changes each update(), from the level. The second rate of each is used off the road.
+enum SpeedMode {
+    SPEED_BRAKE = 0,        // DECEL is held
+    SPEED_ACCEL = 1,        // ACCEL is held
+    SPEED_COAST = 2,        // Neither is held and the speed is above 1
+    SPEED_CREEP = 3,        // Neither is held and the speed is 1 or below
+    NUM_SPEED_MODES = 4
+};
+const fix16_t speed_rates[NUM_SPEED_MODES][2] PROGMEM = LEVEL_SPEED_RATES;
 
-// The player
-Sprite player;
+// The rate at which the fuel tank is filled every frame (0-100 in 3 seconds)
+#define FUEL_REFUEL_RATE    FIX8(1.7)
 
-// Road
-uint8_t road[LCD_Y];            // The x-coordinates of each road piece
-uint8_t road_width = 16;   
-uint8_t road_counter;           // Counts how many steps the road has taken before being moved horizontally
-uint8_t road_curve;             // This decides how many times the road must move before it is moved horizontally
-uint8_t road_direction;
-uint8_t road_section_length;    // How many steps the road has taken in the current length
+// The game being played (see zombie_race.h). The random streams' states are in it too, and are never 0.
+GameState game;
 
-// Terrain
-Sprite terrain[NUM_TERRAIN];                // Array that contains all of the terrain objects in the game
-Sprite terrain_image[NUM_TERRAIN_TYPES];    // Contains sprite information about each type of terrain
+// The player's car is always this far up the screen
+#define PLAYER_Y                (LCD_Y - CAR_HEIGHT - 2)
+// A fuel station below the screen is kept at this height until the next one spawns
+#define FUEL_STATION_GONE       (LCD_Y + 1)
+// The x-coordinate of the road pieces when a game starts (in the middle of the playing area)
+#define ROAD_START_X            (((LCD_X - DASHBOARD_BORDER_X) / 2) - (LEVEL_ROAD_WIDTH / 2) + DASHBOARD_BORDER_X - 1)
 
-// Hazards
-Sprite hazard[NUM_HAZARD];
-Sprite hazard_image[NUM_HAZARD_TYPES];
+// Game time control. The game time is counted in Timer0 overflows while the game is being
+// played, so as a count of Timer0 ticks (see clock_ticks()) it lasts 38 hours.
+uint8_t step = 0;
+uint16_t game_seed;             // What the random streams were seeded with when the game started
+volatile uint32_t game_timer_counter;
+uint8_t game_paused;
+uint32_t time_paused;   // The game time (ms) when the game was paused or ended, so the time shown
+                        // doesn't keep changing on the pause and game over screens
+
+// Splits. The race is cut into NUM_SPLITS equal parts of its length (the distance plus what is
+// left to the finish line) and the game time each part ends at is kept. Like the game time they
+// aren't part of the GameState, as they come from Timer0.
+uint32_t split_ticks[NUM_SPLITS];
+uint8_t splits_reached;
+
+_Static_assert(LCD_Y == ROAD_LENGTH, "The save format expects one road piece per LCD row");
+
+// The obstacles in each band. Bit i is set if obstacle i is active and covers the band. They are
+// worked out from the GameState (see bands_rebuild()) so they aren't part of it.
+ObstacleMask obstacle_bands[NUM_BANDS];
+
+// Collision. Multiplying a bitmap row by collision_shift[n] moves it n pixels to the right in the
+// high byte of the result, the AVR can only shift by one bit at a time but multiplies in 2 cycles
+const uint16_t collision_shift[8] PROGMEM = { 256, 128, 64, 32, 16, 8, 4, 2 };
+
+// Dashboard. Each number is only drawn again when its value changes, the rest of the dashboard 
+// is only drawn when the screen has been cleared (dashboard_valid is false)
+typedef struct Widget {
+    uint8_t x;
+    uint8_t y;
+    uint8_t width;              // The most characters the widget can show
+    uint16_t value;             // The value last drawn
+} Widget;
+
+Widget dashboard_condition = { 10, 2, 3, 0 };
+Widget dashboard_fuel = { 10, 12, 3, 0 };
+Widget dashboard_speed = { 10, 22, 3, 0 };
+bool dashboard_refuelling;      // If the refuelling light was last drawn on
+bool dashboard_valid;           // False if the dashboard has to be drawn from scratch
+
+// Used to find the digits of a number by subtraction (the AVR has no divide instruction)
+const uint16_t decimal_powers[5] PROGMEM = { 10000, 1000, 100, 10, 1 };
+
+// Telemetry. Samples are added to one buffer while the other is sent a few bytes at a time
+// between frames, so the game never waits for USB
+TelemetryMessage telemetry_buffers[2];
+uint8_t telemetry_filling;      // The buffer samples are being added to
+uint8_t telemetry_sending = TELEMETRY_IDLE;     // The buffer being sent
+uint8_t telemetry_sent;         // How many bytes of the buffer being sent have gone
+uint8_t telemetry_dropped;      // Samples dropped since the last message was queued
+uint8_t telemetry_counter;      // Game steps since the last sample
+uint16_t telemetry_step;        // Game steps since the game started
+
+// Save and load (see zombie_race.h for the format)
+SaveBuffer save_buffer;         // Holds the save being sent, or the save being received when loading
 
-// Fuel station
-Sprite fuel_station;
-int fuel_station_counter;   // Counts down to when the fuel station can spawn again
-bool refuelling;
+/**
+ * The progress of loading a save from the server. The save arrives over several frames
+ * of the game loop, see game_state_load_step()
+ **/
+enum LoadState {
+    LOAD_IDLE = 0,
+    LOAD_WAITING = 1,       // Waiting for the LOAD reply
+    LOAD_HEADER = 2,        // Waiting for the number of frames in the reply
+    LOAD_RECEIVING = 3,     // Receiving the frames into save_buffer
+} load_state;
+uint16_t load_received;     // The number of bytes of save_buffer received so far
+uint16_t load_expected;
+uint8_t load_timeout;       // Game loop frames left before giving up on the server
+
+#define LOAD_TIMEOUT        120     // Two seconds
+#define LOAD_BYTES_PER_STEP SAVE_FRAME_SIZE
+
+// Checkpoints, so a game can be rewound a few seconds without the server. A checkpoint is taken
+// every CHECKPOINT_INTERVAL game steps. The newest is kept whole and each older one is kept as the
+// difference from the one after it, which is mostly zeroes and small changes (the road ring only
+// changes where new pieces were added and the obstacles have only moved down a few pixels).
+// The differences are kept in a ring of 256 bytes, so the indices wrap by themselves, and the
+// oldest are dropped as the space is needed. The game time of each checkpoint is kept beside it
+// (it isn't in the GameState), so rewinding winds the clock back too.
+#define CHECKPOINT_INTERVAL     16
+#define CHECKPOINT_MAX_DELTAS   8
+// The most bytes the difference between two checkpoints can take (see checkpoint_encode()). It
+// has to leave room in the pool for the oldest delta to be dropped while it is written.
+#define CHECKPOINT_DELTA_MAX    (sizeof(GameState) + sizeof(GameState) / 64 + 2)
+_Static_assert(CHECKPOINT_DELTA_MAX <= 255, "A checkpoint delta has to fit in the checkpoint pool");
+
+// The tokens of a delta. Each one covers the bytes from where the last one finished.
+#define CHECKPOINT_SKIP         0x00    // 0x00-0x7F: the next 1-128 bytes are the same
+#define CHECKPOINT_SMALL        0x80    // 0x80-0xBF: add -32 to 31 (the low 6 bits) to the next byte
+#define CHECKPOINT_LITERAL      0xC0    // 0xC0-0xFF: add each of the 1-64 bytes that follow to the next bytes
+
+GameState checkpoint_latest;    // The newest checkpoint
+uint32_t checkpoint_latest_time;    // The game time of the newest checkpoint (Timer0 overflows)
+bool checkpoint_valid;          // If checkpoint_latest holds a checkpoint of this game
+uint8_t checkpoint_pool[256];   // Ring of the deltas back to each older checkpoint
+uint8_t checkpoint_pool_end;    // Where the next delta goes
+uint16_t checkpoint_pool_used;
+uint8_t checkpoint_lengths[CHECKPOINT_MAX_DELTAS];  // Ring of the length of each delta, oldest first
+uint32_t checkpoint_times[CHECKPOINT_MAX_DELTAS];   // The game time of the checkpoint each delta goes back to
+uint8_t checkpoint_first;       // The index in checkpoint_lengths[] of the oldest delta
+uint8_t checkpoint_deltas;      // The number of deltas in the pool
+uint8_t checkpoint_counter;     // Game steps since checkpoint_latest was taken
 
 /**
  * Holds information regarding what screen the player should be seeing right now. 
@@ -139,15 +314,6 @@ enum GameScreens {
 	GAMEOVER_SCREEN = 3,
 } game_screen;
 
-/**
- * Commands used for USB communications
- **/
-enum USBCommand {
-    SAVE = 1,
-    LOAD = 2,
-    DEBUG = 3
-};
-
 /**
  * The controls for the game
  **/
@@ -158,88 +324,219 @@ enum Controls {
     DECEL = 3,
     PAUSE = 4,
     SAVE_GAME = 5,
-    LOAD_GAME = 6
+    LOAD_GAME = 6,
+    NUM_CONTROLS = 7
 };
 
-// Game loop controls 
-const double loop_freq = 60.0;
-uint16_t loop_counter;
-
-// Bitmaps
-uint8_t car_image[] = {
-    0b01100000,
-    0b11110000,
-    0b01100000,
-    0b01100000,
-    0b11110000,
-};
-int car_width = 4;
-int car_height = 5;
-
-uint8_t terrain_tree_image[] = {
-    0b00111100,
-    0b01111110,
-    0b11111111,
-    0b00011000,
-    0b00011000,
-};
-int terrain_tree_width = 8;
-int terrain_tree_height = 5;
-
-uint8_t terrain_sign_image[] = {
-    0b01010000,
-    0b11111000,
-    0b11111000,
-    0b01010000,
-    0b00000000,
+/**
+ * The pin each control is read from. The table is walked by the Timer0 interrupt to
+ * sample every control into one byte (bit n is control n).
+ **/
+typedef struct ControlPin {
+    volatile uint8_t * pin;
+    uint8_t bit;
+} ControlPin;
+
+const ControlPin control_pins[NUM_CONTROLS] PROGMEM = {
+    [MOVE_LEFT] = { &PINB, STICK_LEFT },
+    [MOVE_RIGHT] = { &PIND, STICK_RIGHT },
+    [ACCEL] = { &PINF, BUTTON_RIGHT },
+    [DECEL] = { &PINF, BUTTON_LEFT },
+    [PAUSE] = { &PINB, STICK_CENTRE },
+    [SAVE_GAME] = { &PIND, STICK_UP },
+    [LOAD_GAME] = { &PIND, STICK_DOWN },
 };
-int terrain_sign_width = 5;
-int terrain_sign_height = 4;
 
-uint8_t hazard_triangle_image[] = {
-    0b00100000,
-    0b01110000,
-    0b11111000,
-};
-int hazard_triangle_width = 5;
-int hazard_triangle_height = 3;
+// Controls - Used to check if any button/joystick has been activated (don't check PINs)
+volatile uint8_t controls_debounced;    // The debounced state of each control, one bit each
+uint8_t controls_held;              // controls_debounced when this update() started
+uint8_t controls_pressed;           // The controls pressed since the last update()
+#define CONTROL_HELD(c)     ((controls_held >> (c)) & 1)
+#define CONTROL_PRESSED(c)  ((controls_pressed >> (c)) & 1)
+
+// Debounce - a 3 bit counter for each control, spread over three bytes (bit n of each is control n's 
+// counter). It counts the samples in a row that disagree with controls_debounced.
+uint8_t debounce_count0, debounce_count1, debounce_count2;
+
+// Events - pressed and released edges passed from the Timer0 interrupt to update(). The interrupt
+// only writes the head and update() only writes the tail, so no locking is needed.
+#define INPUT_QUEUE_SIZE    8       // Must be a power of 2
+#define INPUT_RELEASED      0x80    // Set in an event if the control was released, otherwise it was pressed
+uint8_t input_queue[INPUT_QUEUE_SIZE];
+volatile uint8_t input_queue_head;
+volatile uint8_t input_queue_tail;
+
+// LCD rendering
+uint16_t lcd_span_checksum[LCD_BANKS][LCD_SPANS];     // The checksum of each span the LCD is showing
+uint8_t lcd_refresh_counter = LCD_FULL_REFRESH;         // Starts full so the first frame is sent whole
+
+// Game loop controls 
+const uint8_t loop_freq = 60;
+volatile bool frame_due;        // Set by the Timer1 interrupt when it's time to start the next frame
+volatile uint8_t frame_ticks;   // Timer1 ticks since the last update() (see scroll_phase)
+uint8_t update_ticks;           // frame_ticks when this update() started
+
+// Potentiometers
+volatile uint16_t adc_filtered[NUM_ADC_CHANNELS];   // Filtered reading of each pot, scaled up by 1 << ADC_FILTER_SHIFT
+uint8_t adc_channel;            // The channel being converted
+uint16_t pot_speed;             // The speed pot when this update() started
+uint8_t lcd_contrast;           // The contrast the LCD was last set to
+
+#ifdef PROFILE
+ProfileRecord profile;          // The times recorded since the last record was sent
+#endif
+
+#ifdef RECORD
+ReplayInput replay_input;       // The frames recorded since the last REPLAY_INPUT message
+bool replay_recording;          // If the current game is being recorded
+uint32_t replay_frames;         // The frames recorded in the current game
+uint8_t replay_stop = REPLAY_NONE;  // Why the recording has to end after this update()
+#endif
+
+// Bitmaps (stored in flash). Each image is up to 8x8 pixels and is written once as its rows, with
+// the leftmost pixel in the top bit and zero rows below it to make 8. The rows are used by the
+// collision checks, and IMAGE_COLUMNS() turns them into columns at compile time for drawing:
+// each column is a byte with the top row in bit 0, the way the screen buffer's banks are laid out.
+#define IMAGE_BIT(row, x, bit)  ((((row) >> (7 - (x))) & 1) << (bit))
+#define IMAGE_COLUMN(x, r0, r1, r2, r3, r4, r5, r6, r7) \
+    (IMAGE_BIT(r0, x, 0) | IMAGE_BIT(r1, x, 1) | IMAGE_BIT(r2, x, 2) | IMAGE_BIT(r3, x, 3) | \
+     IMAGE_BIT(r4, x, 4) | IMAGE_BIT(r5, x, 5) | IMAGE_BIT(r6, x, 6) | IMAGE_BIT(r7, x, 7))
+#define IMAGE_COLUMNS_8(...) { \
+    IMAGE_COLUMN(0, __VA_ARGS__), IMAGE_COLUMN(1, __VA_ARGS__), IMAGE_COLUMN(2, __VA_ARGS__), \
+    IMAGE_COLUMN(3, __VA_ARGS__), IMAGE_COLUMN(4, __VA_ARGS__), IMAGE_COLUMN(5, __VA_ARGS__), \
+    IMAGE_COLUMN(6, __VA_ARGS__), IMAGE_COLUMN(7, __VA_ARGS__) }
+#define IMAGE_COLUMNS(rows)     IMAGE_COLUMNS_8(rows)
+
+#define CAR_ROWS \
+    0b01100000, \
+    0b11110000, \
+    0b01100000, \
+    0b01100000, \
+    0b11110000, \
+    0, 0, 0
+const uint8_t car_image[] PROGMEM = { CAR_ROWS };
+const uint8_t car_columns[] PROGMEM = IMAGE_COLUMNS(CAR_ROWS);
+#define CAR_WIDTH               4
+#define CAR_HEIGHT              5
+
+#define TERRAIN_TREE_ROWS \
+    0b00111100, \
+    0b01111110, \
+    0b11111111, \
+    0b00011000, \
+    0b00011000, \
+    0, 0, 0
+const uint8_t terrain_tree_image[] PROGMEM = { TERRAIN_TREE_ROWS };
+const uint8_t terrain_tree_columns[] PROGMEM = IMAGE_COLUMNS(TERRAIN_TREE_ROWS);
+
+#define TERRAIN_SIGN_ROWS \
+    0b01010000, \
+    0b11111000, \
+    0b11111000, \
+    0b01010000, \
+    0b00000000, \
+    0, 0, 0
+const uint8_t terrain_sign_image[] PROGMEM = { TERRAIN_SIGN_ROWS };
+const uint8_t terrain_sign_columns[] PROGMEM = IMAGE_COLUMNS(TERRAIN_SIGN_ROWS);
+
+#define HAZARD_TRIANGLE_ROWS \
+    0b00100000, \
+    0b01110000, \
+    0b11111000, \
+    0, 0, 0, 0, 0
+const uint8_t hazard_triangle_image[] PROGMEM = { HAZARD_TRIANGLE_ROWS };
+const uint8_t hazard_triangle_columns[] PROGMEM = IMAGE_COLUMNS(HAZARD_TRIANGLE_ROWS);
+
+#define HAZARD_SPIKE_ROWS \
+    0b10101000, \
+    0b11111000, \
+    0, 0, 0, 0, 0, 0
+const uint8_t hazard_spike_image[] PROGMEM = { HAZARD_SPIKE_ROWS };
+const uint8_t hazard_spike_columns[] PROGMEM = IMAGE_COLUMNS(HAZARD_SPIKE_ROWS);
+
+#define FUEL_STATION_ROWS \
+    0b11111111, \
+    0b10000001, \
+    0b10000001, \
+    0b10000001, \
+    0b10000001, \
+    0b10000001, \
+    0b10000001, \
+    0b11111111
+const uint8_t fuel_station_image[] PROGMEM = { FUEL_STATION_ROWS };
+const uint8_t fuel_station_columns[] PROGMEM = IMAGE_COLUMNS(FUEL_STATION_ROWS);
+#define FUEL_STATION_WIDTH      8
+#define FUEL_STATION_HEIGHT     8
+// The length of the straight section of road the fuel station spawns beside
+#define FUEL_STATION_STRAIGHT   (FUEL_STATION_HEIGHT + 6)
+_Static_assert(FUEL_STATION_STRAIGHT <= LEVEL_ROAD_SECTION_MAX, "The road can't be straight for long enough for the fuel station");
 
-uint8_t hazard_spike_image[] = {
-    0b10101000,
-    0b11111000,
+/**
+ * The size and bitmaps of each type of terrain and hazard. The tables are in flash so they 
+ * have to be copied out with memcpy_P (see image_read) before use.
+ **/
+typedef struct Image {
+    uint8_t width;
+    uint8_t height;
+    const uint8_t * bitmap;     // The rows, for collisions
+    const uint8_t * columns;    // The columns, for drawing
+} Image;
+
+const Image obstacle_images[NUM_OBSTACLE_TYPES] PROGMEM = {
+    [TERRAIN_TREE] = { 8, 5, terrain_tree_image, terrain_tree_columns },
+    [TERRAIN_SIGN] = { 5, 4, terrain_sign_image, terrain_sign_columns },
+    [HAZARD_TRIANGLE] = { 5, 3, hazard_triangle_image, hazard_triangle_columns },
+    [HAZARD_SPIKE] = { 5, 2, hazard_spike_image, hazard_spike_columns },
 };
-int hazard_spike_width = 5;
-int hazard_spike_height = 2;
-
-uint8_t fuel_station_image[] = {
-    0b11111111,
-    0b10000001,
-    0b10000001,
-    0b10000001,
-    0b10000001,
-    0b10000001,
-    0b10000001,
-    0b11111111,
+
+// The player's car and the fuel station, for the collision checks
+const Image player_sprite = { CAR_WIDTH, CAR_HEIGHT, car_image, car_columns };
+const Image fuel_station_sprite = { FUEL_STATION_WIDTH, FUEL_STATION_HEIGHT, fuel_station_image, fuel_station_columns };
+
+/**
+ * The start of every game. game_screen_setup() copies it into the game and then only has to
+ * seed the random streams and place what is random (see zombie_race.h for what each field is).
+ **/
+const GameState game_template PROGMEM = {
+    .condition = 100,
+    .fuel = FIX8(FUEL_MAX),
+    .speed = FIX16_FROM_INT(LEVEL_SPEED_MAX),
+    .finish_line = LEVEL_FINISH_LINE,
+    .game_over_loss = true,
+
+    // A straight road in the middle of the screen, with no sections made yet
+    .road = { [0 ... ROAD_LENGTH - 1] = ROAD_START_X },
+    .road_width = LEVEL_ROAD_WIDTH,
+
+    // No fuel station until the first one spawns
+    .fuel_station_y = FUEL_STATION_GONE,
 };
-int fuel_station_width = 8;
-int fuel_station_height = 8;
 
 /***********************************************************************************/
 /* FUNCTION PROTOTYPES                                                             */
 /***********************************************************************************/
 
 // Helper functions
-double elapsed_time(uint16_t timer_counter);
-bool in_bounds(double x, double y);
-uint8_t* get_image_from_pgm(Sprite sprite);
+bool in_bounds(int x, int y);
+void image_read(Image * image, const Image * images, uint8_t type);
+uint8_t obstacle_height(uint8_t index);
+void obstacle_remove(uint8_t index);
 
 // Game loop functions
 void update(void);
 void draw(void);
 
 // General draw functions
-void draw_formatted(int x, int y, char * buffer, int buffer_size, const char * format, ...);
+void clear_playfield(void);
+void clear_area(int x, int y, int width, int height);
+uint8_t format_uint(char * buffer, uint16_t value, uint8_t min_digits);
+uint8_t format_time(char * buffer, uint32_t ms);
+void widget_draw(Widget * widget, uint16_t value, bool force);
+void draw_string_P(int x, int y, const char * str);
+void columns_draw_P(int x0, int y0, uint8_t width, const uint8_t * columns);
+void road_draw(void);
 void sprite_draw_direct(Sprite sprite);
+void show_screen_dirty(void);
 
 // Screen manager
 void change_screen(int new_screen);
@@ -260,22 +557,25 @@ void gameover_screen_update(void);
 void gameover_screen_draw(void);
 
 // Player location and movement functions
-void player_car_setup(void);
 void player_car_reset(void);
 void player_car_move(int dx);
 void player_speed_input(void);
 
 // Road functions
+static inline uint8_t road_x(uint8_t y);
+void road_setup(void);
+void road_generate_section(void);
+void road_generate(void);
+void road_next_section(void);
+void road_reserve_straight(uint8_t length);
 void road_step(void);
 
 // Obstacle functions
-void terrain_image_setup(void);
 void terrain_setup(void);
-void terrain_reset(int index, int y_bot);
+void terrain_reset(uint8_t index, int y_bot);
 void terrain_step(void);
-void hazard_image_setup(void);
 void hazard_setup(void);
-void hazard_reset(int index, int y_bot);
+void hazard_reset(uint8_t index, int y_bot);
 void hazard_step(void);
 
 // Fuel functions
@@ -285,28 +585,107 @@ void check_refuel(void);
 void refuel(void);
 
 // Collision detection
-bool offroad(Sprite sprite);
-bool check_collision(Sprite sprite);
-bool check_sprite_collided(Sprite sprite1, Sprite sprite2);
-bool check_sprite_collided_pixel(Sprite sprite1, Sprite sprite2);
+uint8_t band_of(int y);
+void bands_insert(uint8_t index);
+void bands_remove(uint8_t index);
+void bands_move(uint8_t index, int old_y);
+void bands_rebuild(void);
+ObstacleMask bands_query(int y, uint8_t height);
+bool offroad(int x, int y, uint8_t width);
+bool check_collision(int x, int y, const Image * image);
+bool check_fuel_station_collided(int x, int y, const Image * image);
+bool check_obstacle_collided(uint8_t index, int x, int y, const Image * image);
+bool check_image_collided(int x1, int y1, const Image * image1, int x2, int y2, const Image * image2);
+bool check_sprite_collided_pixel(const uint8_t * rows1, int x1, int y1, uint8_t height1,
+                                 const uint8_t * rows2, int x2, int y2, uint8_t height2);
 void handle_collision(void);
 
+// Physics
+void physics_accelerate(fix16_t rate, int speed_limit);
+void physics_burn_fuel(void);
+bool physics_refuel(void);
+
 // Save and load
 void game_state_save(void);
+void game_state_restore(const GameState * state);
 void game_state_load(void);
+void game_state_load_step(void);
+
+// Checkpoints
+void checkpoint_reset(void);
+void checkpoint_take(void);
+uint8_t checkpoint_encode(const uint8_t * newer, const uint8_t * older);
+uint8_t checkpoint_put(uint8_t data);
+void checkpoint_drop_oldest(void);
+void checkpoint_pop(void);
+bool checkpoint_rewind(void);
+
+// Clock
+static inline bool clock_running(void);
+uint32_t clock_ticks(void);
+uint32_t clock_ms(void);
+uint32_t clock_us(void);
+uint32_t ticks_ms(uint32_t ticks);
+uint32_t ticks_us(uint32_t ticks);
+void clock_set(uint32_t overflows);
+uint32_t clock_overflows(void);
+uint8_t split_distance(uint8_t split);
+void splits_reset(void);
+void splits_update(void);
+void splits_restore(void);
+uint32_t lap_ticks(uint8_t split);
+
+// Telemetry
+void telemetry_sample(void);
+bool telemetry_queue(void);
+void telemetry_drain(void);
+void telemetry_finish(void);
 
 // USB communication
 void usb_send_message(enum USBCommand command, int line_num ,char * buffer, int buffer_size, const char * format, ...);
 
+// Random numbers
+void random_seed(uint16_t seed);
+static inline uint16_t random_next(uint8_t stream);
+static inline uint8_t random_byte(uint8_t stream);
+static inline uint8_t random_below(uint8_t stream, uint8_t n);
+static inline bool random_chance(uint8_t stream, uint16_t threshold);
+
+// Input
+static inline void input_sample(void);
+static inline void input_push(uint8_t event);
+void input_update(void);
+
+// Replays
+#if defined(RECORD) || defined(HEADLESS)
+uint16_t replay_checksum(void);
+#endif
+#ifdef RECORD
+void replay_start(void);
+void replay_record(void);
+void replay_send(void);
+void replay_end(void);
+#endif
+
+// Profiling
+#ifdef PROFILE
+void profile_reset(void);
+void profile_record(uint8_t phase, uint16_t us);
+void profile_frame_end(uint16_t us);
+#endif
+
 // Teensy functions
 void teensy_setup(void);
+void frame_wait(void);
 void adc_init(void);
 uint16_t adc_read(uint8_t channel);
+uint16_t adc_value(uint8_t channel);
 
 /***********************************************************************************/
 /* FUNCTIONS                                                                       */
 /***********************************************************************************/
 
+#ifndef HEADLESS
 /**
  * The entry point for the program
  **/
@@ -317,39 +696,34 @@ int main(void) {
     // Go to the Splash Screen
     change_screen(START_SCREEN);
 
-    // The minimum time we'll take to execute one iteration of the game loop
-    double time_step = 1/loop_freq;
-
     // Start the main game loop
-    loop_counter = 0;
     while(1) {
-        // Time execution started
-        double t = elapsed_time(loop_counter);
+        PROFILE_START(frame_start);
         // Update all of the relevant game logic (sprites, collision, input, etc)
+        PROFILE_START(update_start);
         update();
+        PROFILE_STOP(PROFILE_UPDATE, update_start);
         // Draw the current screen to the LCD
+        PROFILE_START(draw_start);
         draw();
-        // Pause the thread for a bit to stop updating
-        while(elapsed_time(loop_counter)-t < time_step) { } 
+        PROFILE_STOP(PROFILE_DRAW, draw_start);
+        PROFILE_FRAME_END(frame_start);
+        // Send what we can of the telemetry without waiting
+        telemetry_drain();
+        // Make the road ahead while there's time left in the frame
+        road_generate();
+        // Sleep until the next frame is due
+        frame_wait();
     }
 
     return 0;
 }
-
-/**
- * Returns how many seconds (accurate to the 1/100th second) since the player started
- * the game. 
- * Note that the time starts when the player switches to the game screen
- **/
-double elapsed_time(uint16_t timer_counter) {
-    double time = (timer_counter * 256.0 + TCNT0 ) * TIMER0_PRESCALE  / CPU_FREQ;
-    return time;
-}
+#endif
 
 /**
  * Checks if the given coordinate falls in bounds of the playable area
  **/
-bool in_bounds(double x, double y) {
+bool in_bounds(int x, int y) {
     if((x <= DASHBOARD_BORDER_X) || (x > LCD_X-1)) {
         return false;
     } else if((y <= 1) || (y > LCD_Y-1)) {
@@ -359,24 +733,43 @@ bool in_bounds(double x, double y) {
     return true;
 }
 
-uint8_t* get_image_from_pgm(Sprite sprite) {
-    uint8_t img[sprite.height];
-    uint8_t* tmp;
+/**
+ * Copies the size and bitmap address of an image type out of one of the tables in flash
+ **/
+void image_read(Image * image, const Image * images, uint8_t type) {
+    memcpy_P(image, &images[type], sizeof(Image));
+}
 
-    for(int i=0; i < sprite.height; i++) {
-        img[i] = pgm_read_byte(&(sprite.bitmap[i]));
-    }
-    
-    tmp = player.bitmap;
-    player.bitmap = img;
+/**
+ * Returns the height of the obstacle's image
+ **/
+uint8_t obstacle_height(uint8_t index) {
+    return pgm_read_byte(&obstacle_images[game.obstacle_type[index]].height);
+}
 
-    return tmp;
+/**
+ * Takes the obstacle out of the game world until it is reset again
+ **/
+void obstacle_remove(uint8_t index) {
+    if(game.obstacle_active & OBSTACLE_BIT(index)) {
+        bands_remove(index);
+        game.obstacle_active &= ~OBSTACLE_BIT(index);
+    }
 }
 
 /**
  * Update all of the relevant game logic (sprites, collision, input, etc)
  **/
 void update(void) {
+    // Find out which controls have been pressed and how far the game has to move since the last update
+    input_update();
+    REPLAY_RECORD_FRAME();
+
+    // Keep receiving a save if one has been requested
+    if(load_state != LOAD_IDLE) {
+        game_state_load_step();
+    }
+
     // Update the game logic depending on the current screen
     switch(game_screen) {
         case START_SCREEN:
@@ -392,26 +785,31 @@ void update(void) {
             break;
     }
 
-    // Determine what contrast to set the screen to depending on Pot 0
-    int pot1 = adc_read(1);
-    int LCD_contrast = (int)(pot1/1024.0 * LCD_MAX_CONTRAST);
-    LCD_CMD(lcd_set_function, lcd_instr_extended);
-    LCD_CMD(lcd_set_contrast, LCD_contrast);
-    LCD_CMD(lcd_set_function, lcd_instr_basic);
+    // Determine what contrast to set the screen to depending on Pot 1 (only tell the LCD if it changed)
+    uint16_t pot1 = adc_value(1);
+    uint8_t contrast = (uint8_t)(((uint32_t)pot1 * LCD_MAX_CONTRAST) >> 10);
+    if(contrast != lcd_contrast) {
+        lcd_contrast = contrast;
+        LCD_CMD(lcd_set_function, lcd_instr_extended);
+        LCD_CMD(lcd_set_contrast, contrast);
+        LCD_CMD(lcd_set_function, lcd_instr_basic);
+    }
 
-    // Update all control states
-    prev_controls_states[DECEL] = controls_states[DECEL];
-    prev_controls_states[ACCEL] = controls_states[ACCEL];
-    prev_controls_states[PAUSE] = controls_states[PAUSE];
-    prev_controls_states[SAVE_GAME] = controls_states[SAVE_GAME];
-    prev_controls_states[LOAD_GAME] = controls_states[LOAD_GAME];
+    // Finish the recording if the game is over (or can't be replayed any more)
+    REPLAY_RECORD_END();
 }
 
 /**
  * Draw the current screen to the LCD
  **/
 void draw(void) {
-    clear_screen();
+    if(game_screen == GAME_SCREEN) {
+        // The dashboard stays on the screen and only the parts that change are drawn again
+        clear_playfield();
+    } else {
+        clear_screen();
+        dashboard_valid = false;
+    }
 
     // Draw the current screen
     switch(game_screen) {
@@ -428,7 +826,9 @@ void draw(void) {
             break;
     }
 
-    show_screen();
+    PROFILE_START(show_start);
+    show_screen_dirty();
+    PROFILE_STOP(PROFILE_SHOW_SCREEN, show_start);
 
     if(game_screen == GAME_SCREEN) {
         // UNCOMMENT TO DRAW THE PLAYER DIRECTLY TO THE LCD INSTEAD
@@ -438,15 +838,140 @@ void draw(void) {
 }
 
 /**
- * Draws a variable to the LCD screen. 
- * 
- * Taken from Topic 11 adc_pwm_backlight (Author:  Lawrence Buckingham, Queensland University of Technology)
+ * Clears the part of the screen buffer to the right of the dashboard
  **/
-void draw_formatted(int x, int y, char * buffer, int buffer_size, const char * format, ...) {
-	va_list args;
-	va_start(args, format);
-	vsnprintf(buffer, buffer_size, format, args);
-	draw_string(x, y, buffer, FG_COLOUR);
+void clear_playfield(void) {
+    for(uint8_t bank = 0; bank < LCD_BANKS; bank++) {
+        memset(&screen_buffer[bank * LCD_X + DASHBOARD_BORDER_X + 1], 0, LCD_X - DASHBOARD_BORDER_X - 1);
+    }
+}
+
+/**
+ * Clears a rectangle of the screen buffer
+ **/
+void clear_area(int x, int y, int width, int height) {
+    for(int dy = 0; dy < height; dy++) {
+        for(int dx = 0; dx < width; dx++) {
+            draw_pixel(x + dx, y + dy, BG_COLOUR);
+        }
+    }
+}
+
+/**
+ * Writes the digits of value into the buffer, with leading zeroes to make it at least
+ * min_digits long. Returns the number of characters written (not including the terminator).
+ **/
+uint8_t format_uint(char * buffer, uint16_t value, uint8_t min_digits) {
+    uint8_t length = 0;
+    for(uint8_t i = 0; i < 5; i++) {
+        uint16_t power = pgm_read_word(&decimal_powers[i]);
+        char digit = '0';
+        while(value >= power) {
+            value -= power;
+            digit++;
+        }
+        // Skip leading zeroes, but always keep the units
+        if((length > 0) || (digit != '0') || (5 - i <= min_digits) || (i == 4)) {
+            buffer[length++] = digit;
+        }
+    }
+    buffer[length] = 0;
+    return length;
+}
+
+/**
+ * Writes a time in milliseconds as seconds with three decimal places into the buffer (up to
+ * 65535 seconds, longer than any game). Returns the number of characters written.
+ **/
+uint8_t format_time(char * buffer, uint32_t ms) {
+    uint32_t seconds = ms / 1000;
+    uint8_t length = format_uint(buffer, (seconds > UINT16_MAX) ? UINT16_MAX : seconds, 1);
+    buffer[length++] = '.';
+    return length + format_uint(buffer + length, ms % 1000, 3);
+}
+
+/**
+ * Draws a number in the widget's place if it's different to the one last drawn there (or if
+ * force is set)
+ **/
+void widget_draw(Widget * widget, uint16_t value, bool force) {
+    if(!force && (value == widget->value)) {
+        return;
+    }
+    widget->value = value;
+
+    char buffer[6];
+    format_uint(buffer, value, 1);
+    clear_area(widget->x, widget->y, widget->width * CHAR_WIDTH, 8);
+    draw_string(widget->x, widget->y, buffer, FG_COLOUR);
+}
+
+/**
+ * Draws a string stored in flash (use PSTR) without copying it into RAM first
+ **/
+void draw_string_P(int x, int y, const char * str) {
+    char ch;
+    while((ch = pgm_read_byte(str++)) != 0) {
+        draw_char(x, y, ch, FG_COLOUR);
+        x += CHAR_WIDTH;
+    }
+}
+
+/**
+ * Draws an image's columns (see IMAGE_COLUMNS) from flash into the screen buffer with its top
+ * left corner at (x0, y0). A column is a whole byte of a bank, so when y0 is a multiple of 8 each
+ * one is ORed straight into its bank. Otherwise it is shifted across the two banks it covers, by
+ * multiplying since the AVR can only shift by one bit at a time.
+ **/
+void columns_draw_P(int x0, int y0, uint8_t width, const uint8_t * columns) {
+    if((y0 <= -8) || (y0 >= LCD_Y) || (x0 >= LCD_X) || (x0 + width <= 0)) {
+        return;
+    }
+
+    // Clip the columns to the screen
+    uint8_t first = (x0 < 0) ? -x0 : 0;
+    uint8_t last = (x0 + width > LCD_X) ? (LCD_X - x0) : width;
+
+    int8_t bank = y0 >> 3;      // Rounds down, so it's -1 for an image coming in above the screen
+    uint8_t shift = y0 & 7;
+    uint8_t * top = (bank >= 0) ? &screen_buffer[bank * LCD_X + x0] : NULL;
+
+    if(shift == 0) {
+        for(uint8_t dx = first; dx < last; dx++) {
+            top[dx] |= pgm_read_byte(&columns[dx]);
+        }
+        return;
+    }
+
+    uint8_t * bottom = (bank + 1 < LCD_BANKS) ? &screen_buffer[(bank + 1) * LCD_X + x0] : NULL;
+    uint8_t factor = 1 << shift;
+    for(uint8_t dx = first; dx < last; dx++) {
+        uint16_t column = pgm_read_byte(&columns[dx]) * factor;
+        if(top != NULL) {
+            top[dx] |= column & 0xFF;
+        }
+        if(bottom != NULL) {
+            bottom[dx] |= column >> 8;
+        }
+    }
+}
+
+/**
+ * Draws both edges of the road by setting their bits in the screen buffer, one bank at a time
+ **/
+void road_draw(void) {
+    uint8_t index = game.road_head;
+    for(uint8_t bank = 0; bank < LCD_BANKS; bank++) {
+        uint8_t * row = &screen_buffer[bank * LCD_X];
+        for(uint8_t bit = 1; bit != 0; bit <<= 1) {
+            uint8_t x = game.road[index];
+            row[x] |= bit;
+            row[x + game.road_width] |= bit;
+            if(++index == LCD_Y) {
+                index = 0;
+            }
+        }
+    }
 }
 
 /**
@@ -472,7 +997,7 @@ void sprite_draw_direct(Sprite sprite) {
                     int dx = x - x0;
                     int dy = y - y0;
                     // Only draw if the sprite has a value of 1 at the bitmap location
-                    if((sprite.bitmap[(int) (dy + dx / 8)] >> (7 - dx % 8)) & 1) {
+                    if((pgm_read_byte(&sprite.bitmap[(int) (dy + dx / 8)]) >> (7 - dx % 8)) & 1) {
                         SET_BIT(byte_to_write, bit_pos);
                         draw = true;
                     }
@@ -485,6 +1010,54 @@ void sprite_draw_direct(Sprite sprite) {
     }
 }
 
+/**
+ * Sends the parts of the screen buffer that have changed since the last frame to the LCD.
+ * Each bank is checked in spans of LCD_SPAN_WIDTH columns, and neighbouring changed spans
+ * are sent in one go since the LCD moves to the next column by itself after each write.
+ * The whole screen is sent every LCD_FULL_REFRESH frames.
+ **/
+void show_screen_dirty(void) {
+    bool full_refresh = false;
+    if(++lcd_refresh_counter >= LCD_FULL_REFRESH) {
+        lcd_refresh_counter = 0;
+        full_refresh = true;
+    }
+
+    for(uint8_t bank = 0; bank < LCD_BANKS; bank++) {
+        uint8_t * bank_buffer = &screen_buffer[bank * LCD_X];
+        // Whether the LCD's address already points to the start of the current span
+        bool addressed = false;
+
+        for(uint8_t span = 0; span < LCD_SPANS; span++) {
+            uint8_t * span_buffer = &bank_buffer[span * LCD_SPAN_WIDTH];
+
+            // Fletcher style checksum so that moved pixels are detected, not just added ones
+            uint8_t sum1 = 0;
+            uint8_t sum2 = 0;
+            for(uint8_t x = 0; x < LCD_SPAN_WIDTH; x++) {
+                sum1 += span_buffer[x];
+                sum2 += sum1;
+            }
+            uint16_t checksum = ((uint16_t)sum2 << 8) | sum1;
+
+            if(!full_refresh && (checksum == lcd_span_checksum[bank][span])) {
+                addressed = false;
+                continue;
+            }
+            lcd_span_checksum[bank][span] = checksum;
+
+            if(!addressed) {
+                LCD_CMD(lcd_set_x_addr, span * LCD_SPAN_WIDTH);
+                LCD_CMD(lcd_set_y_addr, bank);
+                addressed = true;
+            }
+            for(uint8_t x = 0; x < LCD_SPAN_WIDTH; x++) {
+                LCD_DATA(span_buffer[x]);
+            }
+        }
+    }
+}
+
 /**
  * Performs the setup required to change to a different screen then switches the game
  * to that screen.
@@ -495,6 +1068,10 @@ void change_screen(int new_screen) {
 		case GAME_SCREEN:
 			game_screen_setup();
 			break;
+		case GAMEOVER_SCREEN:
+			// The clock stops here, keep the time it stopped at
+			time_paused = clock_ms();
+			break;
 		default:
 			break;
 	}
@@ -503,7 +1080,7 @@ void change_screen(int new_screen) {
 
     // Test: Splash screen
     //char buf[100];
-    //usb_send_message(DEBUG, 4, buf, 100, "Timestep: %.3f\nSW2: %d\nSW3: %d\nScreen: %d\n%d\n", elapsed_time(game_timer_counter), controls_states[DECEL], controls_states[ACCEL], game_screen, 0);
+    //usb_send_message(DEBUG, 4, buf, 100, "Timestep: %.3f\nSW2: %d\nSW3: %d\nScreen: %d\n%d\n", elapsed_time(game_timer_counter), CONTROL_HELD(DECEL), CONTROL_HELD(ACCEL), game_screen, 0);
 }
 
 /**
@@ -511,24 +1088,22 @@ void change_screen(int new_screen) {
  **/
 void start_screen_update(void) {
     // Check if a button has been pressed and proceed to the game screen if it has
-    int button_left_edge = (prev_controls_states[DECEL] == 0) && (controls_states[DECEL] != 0);
-    int button_right_edge = (prev_controls_states[ACCEL] == 0) && (controls_states[ACCEL] != 0);
-    if(button_left_edge || button_right_edge) {
+    if(CONTROL_PRESSED(DECEL) || CONTROL_PRESSED(ACCEL)) {
         change_screen(GAME_SCREEN);
     }
 
     // Test: Splash screen
     //char buf[100];
-    //usb_send_message(DEBUG, 4, buf, 100, "Timestep: %.3f\nSW2: %d\nSW3: %d\nScreen: %d\n%d\n", elapsed_time(game_timer_counter), controls_states[DECEL], controls_states[ACCEL], game_screen, 0);
+    //usb_send_message(DEBUG, 4, buf, 100, "Timestep: %.3f\nSW2: %d\nSW3: %d\nScreen: %d\n%d\n", elapsed_time(game_timer_counter), CONTROL_HELD(DECEL), CONTROL_HELD(ACCEL), game_screen, 0);
 }
 
 /**
  * Displays basic information about the game
  **/
 void start_screen_draw(void) {
-    draw_string(13, 3, "Zombie Race", FG_COLOUR);
-    draw_string(6, 30, "Pedro Alves", FG_COLOUR);
-    draw_string(6, 38, "n9424342", FG_COLOUR);
+    draw_string_P(13, 3, PSTR("Zombie Race"));
+    draw_string_P(6, 30, PSTR("Pedro Alves"));
+    draw_string_P(6, 38, PSTR("n9424342"));
 }
 
 /**
@@ -536,34 +1111,43 @@ void start_screen_draw(void) {
  **/
 void game_screen_update(void) {
     // Deals with input that decides if should pause the game or not (only toggle on press not hold)
-    if(((prev_controls_states[PAUSE] == 0) && (controls_states[PAUSE] != 0))) {
+    if(CONTROL_PRESSED(PAUSE)) {
         game_paused ^= 1;
         if(game_paused) {
-            time_paused = elapsed_time(game_timer_counter);
+            time_paused = clock_ms();
         }
     }
 
     if(!game_paused) {
         // Steps through all of the main game logic involving input, collisions, etc.
-        if((speed_counter) > SPEED_THRESH) {
+        // The scroll each tick is 32 bits, as it is 65536 or more at a speed of 64 and up
+        uint32_t phase = game.scroll_phase + (uint32_t)update_ticks * (uint32_t)(game.speed >> SCROLL_SHIFT);
+        for(uint8_t i = 0; (phase >= SCROLL_PIXEL) && (i < SCROLL_MAX_STEPS); i++) {
+            phase -= SCROLL_PIXEL;
             step = false;
-            speed_counter = 0;
             game_screen_step();
+            if(game_screen != GAME_SCREEN) {
+                break;
+            }
         }
+        // Drop any whole pixels left after a long stall rather than rushing through them
+        game.scroll_phase = phase & (SCROLL_PIXEL - 1);
         player_speed_input();
         // Refuel the car
         refuel();
     } else {
-        // Checks if the user wants to load or save the game
-        if(((prev_controls_states[SAVE_GAME] == 0) && (controls_states[SAVE_GAME] != 0))) {
+        // Checks if the user wants to load or save the game, or rewind to a checkpoint
+        if(CONTROL_PRESSED(SAVE_GAME)) {
             game_state_save();
-        }else if(((prev_controls_states[LOAD_GAME] != 0))) {
+        }else if(CONTROL_PRESSED(LOAD_GAME)) {
             game_state_load();
+        } else if(CONTROL_PRESSED(MOVE_LEFT) && checkpoint_rewind()) {
+            time_paused = clock_ms();
         }
 
         // Test: Paused View
         //char buf[100];
-        //usb_send_message(DEBUG, 2, buf, 100, "Program time: %.3f\nGame time: %.3f\n%d\n", elapsed_time(loop_counter), time_paused, 0);
+        //usb_send_message(DEBUG, 2, buf, 100, "Program time: %.3f\nGame time: %.3f\n%d\n", elapsed_time(game_timer_counter), time_paused, 0);
     }
 }
 
@@ -574,24 +1158,37 @@ void game_screen_draw(void) {
     dashboard_draw();
 
     // Draw the player
-    sprite_draw(&player);
+    columns_draw_P(game.player_x, PLAYER_Y, CAR_WIDTH, car_columns);
 
     // Draw the paused screen
     if(game_paused) {
-        char buffer[80];
-        draw_string(30, 2, "TIME:", FG_COLOUR);
-        draw_formatted(30, 12, buffer, sizeof(buffer), "%.3f", time_paused);
-        draw_string(30, 22, "DISTANCE:", FG_COLOUR);
-        draw_formatted(30, 32, buffer, sizeof(buffer), "%d", distance);
+        char buffer[16];
+        draw_string_P(30, 2, PSTR("TIME:"));
+        format_time(buffer, time_paused);
+        draw_string(30, 12, buffer, FG_COLOUR);
+        draw_string_P(30, 22, PSTR("DIST:"));
+        format_uint(buffer, game.distance, 1);
+        draw_string(30 + 5 * CHAR_WIDTH, 22, buffer, FG_COLOUR);
+        // How long the last part of the race took
+        if(splits_reached > 0) {
+            buffer[0] = 'S';
+            buffer[1] = '0' + splits_reached;
+            buffer[2] = ':';
+            format_time(buffer + 3, ticks_ms(lap_ticks(splits_reached - 1)));
+            draw_string(30, 32, buffer, FG_COLOUR);
+        }
+        if(checkpoint_valid) {
+            draw_string_P(30, 40, PSTR("<:REWIND"));
+        }
 
         // Test: Paused View
         //usb_send_message(DEBUG, 2, buffer, 80, "Time step: %.3f\nDistance: %d\n%d\n", time_paused, distance, 0);
 
         // Test: Horizontal Movement
-        //usb_send_message(DEBUG, 5, buffer, 80, "Time step: %.3f\nPlayer x: %.0f\nLeft: %d\nRight: %d\nSpeed: %.0f\n%d\n", time_paused, player.x, controls_states[MOVE_LEFT], controls_states[MOVE_RIGHT], speed, 0);
+        //usb_send_message(DEBUG, 5, buffer, 80, "Time step: %.3f\nPlayer x: %.0f\nLeft: %d\nRight: %d\nSpeed: %.0f\n%d\n", time_paused, player.x, CONTROL_HELD(MOVE_LEFT), CONTROL_HELD(MOVE_RIGHT), speed, 0);
 
         // Test: Acceleration and Speed
-        //usb_send_message(DEBUG, 5, buffer, 80, "Time step: %.3f\nOffroad: %d\nLeft: %d\nRight: %d\nSpeed: %.0f\n%d\n", time_paused, offroad(player), controls_states[DECEL], controls_states[ACCEL], speed, 0);
+        //usb_send_message(DEBUG, 5, buffer, 80, "Time step: %.3f\nOffroad: %d\nLeft: %d\nRight: %d\nSpeed: %.0f\n%d\n", time_paused, offroad(player), CONTROL_HELD(DECEL), CONTROL_HELD(ACCEL), speed, 0);
 
         // Test: Scenery and Obstacles
         //usb_send_message(DEBUG, 3, buffer, 80, "Time step: %.3f\nTerrain y: %.0f\nSpeed: %.0f\n%d\n", time_paused, terrain[1].y, speed, 0);
@@ -606,13 +1203,13 @@ void game_screen_draw(void) {
         //usb_send_message(DEBUG, 3, buffer, 80, "Time step: %.3f\nDistance: %d\nSpeed: %.0f\n%d\n", time_paused, distance, speed, 0);
 
         // Test: Collision
-        //usb_send_message(DEBUG, 6, buffer, 80, "Time step: %.3f\nCar x: %.0f\nCar x2: %.0f\nObject x: %.0f\nObject x2: %.0f\nCollided: %d\n%d\n", time_paused, player.x, player.x+player.width, hazard[0].x, hazard[0].width + hazard[0].x, check_sprite_collided(player, hazard[0]), 0);
+        //usb_send_message(DEBUG, 6, buffer, 80, "Time step: %.3f\nCar x: %.0f\nCar x2: %.0f\nObject x: %.0f\nObject x2: %.0f\nCollided: %d\n%d\n", time_paused, player.x, player.x+player.width, hazard[0].x, hazard[0].width + hazard[0].x, check_sprite_collided(&player, &hazard[0]), 0);
 
         // Test: Collision Test plan 2 (change the object to either hazard, terrain or the fuel station)
         //usb_send_message(DEBUG, 6, buffer, 80, "Time step: %.3f\nCar x: %.0f\nCar x2: %.0f\nCar y: %.0f\nObject y: %.0f\nCondition: %d\n%d\n", time_paused, player.x, player.x+player.width, player.y, fuel_station.y, condition, 0);
 
         // Test: Curved Road
-        //usb_send_message(DEBUG, 6, buffer, 80, "Time step: %.3f\nCar x: %.0f\nCar x2: %.0f\nRoad x: %d\nRoad x2: %d\nOffroad: %d\n%d\n", time_paused, player.x, player.x+player.width, road[LCD_Y-5], road[LCD_Y-5] + road_width, offroad(player), 0);
+        //usb_send_message(DEBUG, 6, buffer, 80, "Time step: %.3f\nCar x: %.0f\nCar x2: %.0f\nRoad x: %d\nRoad x2: %d\nOffroad: %d\n%d\n", time_paused, player.x, player.x+player.width, road_x(LCD_Y-5), road_x(LCD_Y-5) + road_width, offroad(player), 0);
 
         // Test: Accelerator and Brake
         //usb_send_message(DEBUG, 3, buffer, 80, "Time step: %.3f\nSpeed: %.0f\nOffroad: %d\n%d\n", time_paused, speed, offroad(player), 0);
@@ -623,29 +1220,20 @@ void game_screen_draw(void) {
         // Test: Fuel level increases gradually
         //usb_send_message(DEBUG, 2, buffer, 80, "Time step: %.3f\nFuel: %.0f\n%d\n", time_paused, fuel, 0);
     } else {
-        // Draw the terrain
-        for(int i=0; i<NUM_TERRAIN; i++) {
-            //temp = get_image_from_pgm(terrain[i]);
-            sprite_draw(&terrain[i]);
-            //terrain[i].bitmap = temp;
-        }
-
-        // Draw the hazards
-        for(int i=0; i<NUM_HAZARD; i++) {
-            //temp = get_image_from_pgm(hazard[i]);
-            sprite_draw(&hazard[i]);
-            //hazard[i].bitmap = temp;
+        // Draw the terrain and hazards
+        ObstacleMask active = game.obstacle_active;
+        for(uint8_t i=0; active != 0; i++, active >>= 1) {
+            if(active & 1) {
+                Image image;
+                image_read(&image, obstacle_images, game.obstacle_type[i]);
+                columns_draw_P(game.obstacle_x[i], game.obstacle_y[i], image.width, image.columns);
+            }
         }
         
         // Draw the road
-        for(int y=0; y<LCD_Y; y++) {
-            draw_pixel(road[y], y, FG_COLOUR);
-            draw_pixel(road[y]+road_width, y, FG_COLOUR);
-        }
-        
-        //uint8_t* temp = get_image_from_pgm(fuel_station);
-        sprite_draw(&fuel_station);
-        //fuel_station.bitmap = temp;
+        road_draw();
+
+        columns_draw_P(game.fuel_station_x, game.fuel_station_y, FUEL_STATION_WIDTH, fuel_station_columns);
     }
 }
 
@@ -653,21 +1241,31 @@ void game_screen_draw(void) {
  * Draws the dashboard containing info about the current game
  **/
 void dashboard_draw(void) {
-    // Draw the border separating from the playable area
-    draw_line(DASHBOARD_BORDER_X, 0, DASHBOARD_BORDER_X, LCD_Y-1, FG_COLOUR);
+    // The screen has been cleared so draw everything
+    bool redraw = !dashboard_valid;
+    if(redraw) {
+        // Draw the border separating from the playable area
+        draw_line(DASHBOARD_BORDER_X, 0, DASHBOARD_BORDER_X, LCD_Y-1, FG_COLOUR);
+
+        draw_string_P(1, 2, PSTR("H:"));
+        draw_string_P(1, 12, PSTR("F:"));
+        draw_string_P(1, 22, PSTR("S:"));
+        dashboard_valid = true;
+    }
 
     // Draw the car's information
-    char buffer[80];
-    draw_string(1, 2, "H:", FG_COLOUR);
-    draw_formatted(10, 2, buffer, sizeof(buffer), "%d", condition);
-    draw_string(1, 12, "F:", FG_COLOUR);
-    draw_formatted(10, 12, buffer, sizeof(buffer), "%.0f", fuel);
-    draw_string(1, 22, "S:", FG_COLOUR);
-    draw_formatted(10, 22, buffer, sizeof(buffer), "%.0f", speed);
+    widget_draw(&dashboard_condition, game.condition, redraw);
+    // The fuel can be below 0 until the next game step ends the game, which the widget can't show
+    widget_draw(&dashboard_fuel, (game.fuel > 0) ? FIX8_ROUND(game.fuel) : 0, redraw);
+    widget_draw(&dashboard_speed, FIX16_ROUND(game.speed), redraw);
 
     // Warning lights
-    if(refuelling) {
-        draw_char(1, 32, 'R', FG_COLOUR);
+    if(redraw || (game.refuelling != dashboard_refuelling)) {
+        dashboard_refuelling = game.refuelling;
+        clear_area(1, 32, CHAR_WIDTH, 8);
+        if(game.refuelling) {
+            draw_char(1, 32, 'R', FG_COLOUR);
+        }
     }
 
     // Test: Dashboard
@@ -681,31 +1279,32 @@ void dashboard_draw(void) {
  **/
 void game_screen_step(void) {
     // Check if we ran out of fuel
-    if(fuel <= 0) {
+    if(game.fuel <= 0) {
         change_screen(GAMEOVER_SCREEN);
     }
 
     // Deals with input that controls horizontal movement
-    if(controls_states[MOVE_LEFT]) {
+    if(CONTROL_HELD(MOVE_LEFT)) {
         player_car_move(-1);
-    } else if(controls_states[MOVE_RIGHT]) {
+    } else if(CONTROL_HELD(MOVE_RIGHT)) {
         player_car_move(1);
     }
 
-    if(++distance_counter > FUEL_FACTOR) {
+    if(++game.distance_counter > LEVEL_FUEL_FACTOR) {
         // Update the fuel
-        fuel--;
+        physics_burn_fuel();
         // Update the distance
-        distance++;
-        finish_line--;
+        game.distance++;
+        game.finish_line--;
+        splits_update();
 
-        distance_counter = 0;
+        game.distance_counter = 0;
     }
 
     // Check if the car has collided with an obstacle
-    if(check_collision(player)) {
+    if(check_collision(game.player_x, PLAYER_Y, &player_sprite)) {
         // Check if the car has collided with a fuel station
-        if(check_sprite_collided(player,fuel_station)) {
+        if(check_fuel_station_collided(game.player_x, PLAYER_Y, &player_sprite)) {
             change_screen(GAMEOVER_SCREEN);
         } else {
             handle_collision();
@@ -719,9 +1318,16 @@ void game_screen_step(void) {
     road_step();
 
     // Check if the player has won
-    if(finish_line < 1) {
+    if(game.finish_line < 1) {
         change_screen(GAMEOVER_SCREEN);
-        game_over_loss = false;
+        game.game_over_loss = false;
+    }
+
+    telemetry_sample();
+
+    // Keep checkpoints of the game while it is still going
+    if((++checkpoint_counter >= CHECKPOINT_INTERVAL) && (game_screen == GAME_SCREEN)) {
+        checkpoint_take();
     }
 
     // Testing: Fuel
@@ -740,46 +1346,36 @@ void game_screen_step(void) {
  * game
  **/
 void game_screen_setup(void) {
-    // Initialise random number generator
-    srand(TCNT0);
+    // Start from the template, then initialise the random streams (keeping the seed so the
+    // game can be replayed)
+    memcpy_P(&game, &game_template, sizeof(game));
+    memset(obstacle_bands, 0, sizeof(obstacle_bands));
+    game_seed = TCNT0;
+    random_seed(game_seed);
     game_paused = 0;
-    distance_counter = 0;
-    speed_counter = 0;
-    finish_line = 250;
-    game_over_loss = true;
-    
-    // Setup the initial car information
-    condition = 100;
-    fuel = FUEL_MAX;
-    speed = SPEED_MAX;
-    distance = 0;
 
     // Reset the game time
-    game_timer_counter = 0;
+    clock_set(0);
+    splits_reset();
+    telemetry_step = 0;
 
     // Set the timer so that the game can start stepping
     TCNT1 = 0x00;
 
     // Setup the road
-    int road_x = ((LCD_X-DASHBOARD_BORDER_X)/2) - (road_width/2) + DASHBOARD_BORDER_X - 1;
-    for(int y=0; y<LCD_Y; y++) {
-        road[y] = road_x;
-    }
-    road_counter = 0;
-    road_curve = ROAD_CURVE_MIN;
-    road_direction = ROAD_STRAIGHT;
-    road_section_length = rand() % (ROAD_SECTION_MAX + 1 - ROAD_SECTION_MIN) + ROAD_SECTION_MIN;
-    
+    road_setup();
+
     // Decide when to spawn the first fuel station
-    fuel_station_counter = rand() % (FUEL_STAION_MAX + 1 - FUEL_STATION_MIN) + FUEL_STATION_MIN;
-    // Create the fuel station sprite
-    sprite_init(&fuel_station, -10, -10, fuel_station_width, fuel_station_height, fuel_station_image);
+    game.fuel_station_counter = LEVEL_FUEL_STATION_MIN + random_below(RANDOM_FUEL, LEVEL_FUEL_STATION_RANGE);
 
     // Setup the player
-    player_car_setup();
+    player_car_reset();
     // Setup the obstacles
     terrain_setup();
     hazard_setup();
+    checkpoint_reset();
+
+    REPLAY_RECORD_START();
 }
 
 /**
@@ -788,20 +1384,28 @@ void game_screen_setup(void) {
  **/
 void gameover_screen_update(void) {
     // If the left button is pressed, go to title screen
-    if((prev_controls_states[DECEL] == 0) && (controls_states[DECEL] != 0)) {
+    if(CONTROL_PRESSED(DECEL)) {
         change_screen(START_SCREEN);
     }
 
     // If the right button is pressed, start a new game straight away
-    if((prev_controls_states[ACCEL] == 0) && (controls_states[ACCEL] != 0)) {
+    if(CONTROL_PRESSED(ACCEL)) {
         change_screen(GAME_SCREEN);
     }
 
     // If the down button is pressed, load a new game from the server via USB
-    if(((prev_controls_states[LOAD_GAME] == 0) && (controls_states[LOAD_GAME] != 0))) {
+    if(CONTROL_PRESSED(LOAD_GAME)) {
         game_state_load();
     }
 
+    // If the centre button is pressed, carry on (paused) from the last checkpoint. A RECORD build
+    // ended its recording when the game ended, so the rest of this game isn't recorded.
+    if(CONTROL_PRESSED(PAUSE) && game.game_over_loss && checkpoint_rewind()) {
+        game_paused = 1;
+        time_paused = clock_ms();
+        game_screen = GAME_SCREEN;
+    }
+
     // Test: Game over screen
     //char buffer[80];
     //usb_send_message(DEBUG, 3, buffer, 80, "Time step: %.3f\nDistance: %d\nGame lost: %d\n%d\n", elapsed_time(game_timer_counter), distance, game_over_loss, 0);
@@ -811,37 +1415,32 @@ void gameover_screen_update(void) {
  * Draw the prompts for the player to decide what to prooced to
  **/
 void gameover_screen_draw(void) {
-    if(game_over_loss) {
-        draw_string(18, 2, "Game Over", FG_COLOUR);
+    if(game.game_over_loss) {
+        draw_string_P(18, 2, PSTR("Game Over"));
     }else {
-        draw_string(18, 2, "You won", FG_COLOUR);
+        draw_string_P(18, 2, PSTR("You won"));
     }
     char buf[30];
-    draw_formatted(1, 10, buf, 30, "T:%.3f,D: %d", elapsed_time(game_timer_counter), distance);
-    draw_string(1, LCD_Y-27, "SW2 for Splash", FG_COLOUR);
-    draw_string(1, LCD_Y-17, "SW3 for Game", FG_COLOUR);
-    draw_string(1, LCD_Y-7, "SWA for Load", FG_COLOUR);
-}
-
-/**
- * Place the player's car sprite in the middle of the road
- **/
-void player_car_setup(void) {
-    int y = LCD_Y - car_height - 2;
-    int x = (road_width/2) + road[y] - (car_width/2) + 1;
-
-    sprite_init(&player, x, y, car_width, car_height, car_image);
+    uint8_t length = 2;
+    strcpy_P(buf, PSTR("T:"));
+    length += format_time(buf + length, time_paused);
+    strcpy_P(buf + length, PSTR(",D: "));
+    length += 4;
+    format_uint(buf + length, game.distance, 1);
+    draw_string(1, 10, buf, FG_COLOUR);
+    draw_string_P(1, LCD_Y-29, PSTR("SW2 for Splash"));
+    draw_string_P(1, LCD_Y-22, PSTR("SW3 for Game"));
+    draw_string_P(1, LCD_Y-15, PSTR("SWA for Load"));
+    if(game.game_over_loss && checkpoint_valid) {
+        draw_string_P(1, LCD_Y-8, PSTR("Centre: Retry"));
+    }
 }
 
 /**
- * Add the player to the middle of the road again
+ * Places the player's car in the middle of the road
  **/
 void player_car_reset(void) {
-    int y = LCD_Y - car_height - 2;
-    int x = (road_width/2) + road[y] - (car_width/2) + 1;
-
-    player.x = x;
-    player.y = y;
+    game.player_x = (game.road_width/2) + road_x(PLAYER_Y) - (CAR_WIDTH/2) + 1;
 }
 
 /**
@@ -849,19 +1448,15 @@ void player_car_reset(void) {
  * Will take into account collisions and the speed of the car to modify the dx given
  **/
 void player_car_move(int dx) {
-    double x = player.x + dx;
+    int x = game.player_x + dx;
     // Check if the player will still be bounded
-    if(!in_bounds(x, player.y)) {
-        dx = 0;
-    } else if(!in_bounds(x+player.width, player.y)) {
-        dx = 0;
+    if(!in_bounds(x, PLAYER_Y) || !in_bounds(x + CAR_WIDTH, PLAYER_Y)) {
+        return;
     }
 
-    player.x += dx;
-
     // Check if the car will collide sideways with any object
-    if(check_collision(player)) {
-        player.x -= dx;
+    if(!check_collision(x, PLAYER_Y, &player_sprite)) {
+        game.player_x = x;
     }
 }
 
@@ -870,73 +1465,124 @@ void player_car_move(int dx) {
  **/
 void player_speed_input(void) {
     // Sets the player's maximum speed through the ADC
-    int max = SPEED_MAX;
-    if(offroad(player)) {
-        max = SPEED_OFFROAD_MAX;
-    }
+    bool off = offroad(game.player_x, PLAYER_Y, CAR_WIDTH);
+    int max = off ? LEVEL_SPEED_OFFROAD_MAX : LEVEL_SPEED_MAX;
 
-    int pot0 = adc_read(0);
-    int speed_limit = (int)(pot0/1024.0 * max);
+    int pot0 = pot_speed;
+    int speed_limit = (int)(((uint16_t)pot0 * max) >> 10);
     speed_limit++;
 
-    double rate = 0;
-    // Handle acceleration
-    // Accelerate or decelerate controls
-    if(controls_states[DECEL]) {
-        // Calculate rate to decrease speed in order to go from 10 to 0 in 2 seconds
-        rate = -10.0/40.0;
-    }else if(controls_states[ACCEL]) {
-        // Calculate rate to increase speed in order to go from 1 to 3 in 5 seconds
-        if(offroad(player)) {
-            rate = 3.0/120.0;
-        }else { // Calculate rate to increase speed in order to go from 1 to 10 in 5 seconds
-            rate = 10.0/110.0;
-        }
-    }else { // If no button is being pressed
+    // Handle acceleration with the rate the level has for what the controls are doing
+    uint8_t mode;
+    if(CONTROL_HELD(DECEL)) {
+        mode = SPEED_BRAKE;
+    } else if(CONTROL_HELD(ACCEL)) {
+        mode = SPEED_ACCEL;
+    } else if(game.speed > FIX16_FROM_INT(1)) {
         // Decrease speed if above 1 or increase to 1 if below
-        if(speed > 1) {
-            // Calculate rate to increase speed in order to go from 3 to 1 in 3 seconds
-            if(offroad(player)) {
-                rate = -3.0/80.0;
-            }else { // Calculate rate to increase speed in order to go from 10 to 1 in 3 seconds
-                rate = -10.0/75.0;
-            }
-        }else {
-            // Calculate rate to increase speed in order to go from 0 to 1 in 3 seconds
-            if(offroad(player)) {
-                rate = 1.0/130.0;
-            }else { // Calculate rate to increase speed in order to go from 0 to 1 in 2 seconds
-                rate = 1.0/75.0;
-            }
-        }
+        mode = SPEED_COAST;
+    } else {
+        mode = SPEED_CREEP;
     }
+    fix16_t rate = (fix16_t)pgm_read_dword(&speed_rates[mode][off]);
 
-    speed += rate;
-
-    if(speed > speed_limit) {
-       speed = speed_limit;
-    }else if(speed < 0) {
-        speed = 0;
-    }
+    physics_accelerate(rate, speed_limit);
 
     // Test: ADC Pot0
     //char buffer[80];
     //usb_send_message(DEBUG, 3, buffer, 80, "Time step: %.3f\nPot0: %d\nSpeed Limit: %d\n%d\n", time_paused, pot0, speed_limit, 0);
 }
 
+/**
+ * Returns the x-coordinate of the road piece at row y of the screen
+ **/
+static inline uint8_t road_x(uint8_t y) {
+    uint8_t index = game.road_head + y;
+    if(index >= LCD_Y) {
+        index -= LCD_Y;
+    }
+    return game.road[index];
+}
+
+/**
+ * Starts the road that game_template put in the middle of the screen. It starts straight,
+ * for as long as the first section.
+ **/
+void road_setup(void) {
+    road_next_section();
+    game.road_direction = ROAD_STRAIGHT;
+    game.road_curve = LEVEL_ROAD_CURVE_MIN;
+}
+
+/**
+ * Adds a random section to the end of the queue. The direction comes from the lowest bit of
+ * one random number and the curve and length are scaled from the rest by multiplying.
+ **/
+void road_generate_section(void) {
+    uint16_t number = random_next(RANDOM_ROAD);
+    uint8_t low = number & 0xFF;
+    uint8_t high = number >> 8;
+
+    uint8_t index = game.road_queue_head + game.road_queue_count;
+    if(index >= ROAD_QUEUE_LENGTH) {
+        index -= ROAD_QUEUE_LENGTH;
+    }
+    RoadSection * section = &game.road_queue[index];
+    // After the initial road straight, we only want to have turns naturally
+    section->direction = (low & 1) ? ROAD_RIGHT : ROAD_LEFT;
+    section->curve = LEVEL_ROAD_CURVE_MIN + (((low >> 1) * LEVEL_ROAD_CURVE_RANGE) >> 7);
+    section->length = LEVEL_ROAD_SECTION_MIN + (((uint16_t)high * LEVEL_ROAD_SECTION_RANGE) >> 8);
+    game.road_queue_count++;
+}
+
+/**
+ * Fills the queue of sections still to come
+ **/
+void road_generate(void) {
+    while(game.road_queue_count < ROAD_QUEUE_LENGTH) {
+        road_generate_section();
+    }
+}
+
+/**
+ * Starts the next section of road in the queue (making it first if the queue has run out)
+ **/
+void road_next_section(void) {
+    if(game.road_queue_count == 0) {
+        road_generate_section();
+    }
+    const RoadSection * section = &game.road_queue[game.road_queue_head];
+    game.road_direction = section->direction;
+    game.road_curve = section->curve;
+    game.road_section_length = section->length;
+    game.road_counter = 0;
+
+    game.road_queue_head = (game.road_queue_head == ROAD_QUEUE_LENGTH - 1) ? 0 : (game.road_queue_head + 1);
+    game.road_queue_count--;
+}
+
+/**
+ * Asks for a straight section of the given length once the current section ends. The fuel
+ * station is spawned beside it when it starts (see road_step()). The sections in the queue
+ * are left as they are, they just come after it.
+ **/
+void road_reserve_straight(uint8_t length) {
+    game.road_reserved = length;
+}
+
 /**
  * Steps the x-coordinate of the road down by 1 and creates a new road piece
  * at the top of the screen.
  **/
 void road_step(void) {
-    road_counter++;
+    game.road_counter++;
 
     // The x-coordinate of the new road piece being added
-    int x = road[0];
+    int x = road_x(0);
     int dx;
     
     // Decide which direction the new road piece will be placed
-    switch(road_direction) {
+    switch(game.road_direction) {
         case ROAD_STRAIGHT:
             dx = 0;
             break;
@@ -951,127 +1597,109 @@ void road_step(void) {
             break;
     }
 
-    if((x+dx+road_width < LCD_X-1) && (x+dx > DASHBOARD_BORDER_X) && (road_counter > road_curve)) {
-        road_counter = 0;
+    if((x+dx+game.road_width < LCD_X-1) && (x+dx > DASHBOARD_BORDER_X) && (game.road_counter > game.road_curve)) {
+        game.road_counter = 0;
         x += dx;
     }
     
-    // Remove the bottom road piece and shift everything down
-    memmove(&road[1], &road[0], (LCD_Y-1)*sizeof(uint8_t));
-    // Add the new piece of road
-    road[0] = x;
+    // Move the top of the ring up one piece, which replaces the bottom piece with the new one
+    game.road_head = (game.road_head == 0) ? (LCD_Y - 1) : (game.road_head - 1);
+    game.road[game.road_head] = x;
 
-    road_section_length--;
+    game.road_section_length--;
     // If it's time to switch directions (added another check in case of overflow)
-    if((road_section_length == 0) || (road_section_length > ROAD_SECTION_MAX)) {
-        road_direction = rand() % 2;    // After the initial road straight, we only want to have turns naturally
-        road_curve = rand() % (ROAD_CURVE_MAX + 1 - ROAD_CURVE_MIN) + ROAD_CURVE_MIN;
-        road_section_length = rand() % (ROAD_SECTION_MAX + 1 - ROAD_SECTION_MIN) + ROAD_SECTION_MIN;
-        road_counter = 0;
+    if((game.road_section_length == 0) || (game.road_section_length > LEVEL_ROAD_SECTION_MAX)) {
+        if(game.road_reserved != 0) {
+            // Keep the road straight while the fuel station goes past
+            game.road_direction = ROAD_STRAIGHT;
+            game.road_section_length = game.road_reserved;
+            game.road_reserved = 0;
+            fuel_station_reset();
+        } else {
+            road_next_section();
+        }
     }
 }
 
 /**
- * Create the sprites which hold the bitmap information about each terrain type
- **/
-void terrain_image_setup(void){
-    // Setup the tree bitmap
-    sprite_init(&terrain_image[TERRAIN_TREE], -1, -1, terrain_tree_width, terrain_tree_height, terrain_tree_image);
-    // Setup the sign bitmap
-    sprite_init(&terrain_image[TERRAIN_SIGN], -1, -1, terrain_sign_width, terrain_sign_height, terrain_sign_image);
-}
-
-/**
- * Initialises the terrain array by setting each terrain sprite in the game world. 
+ * Places all of the terrain in the game world
  **/
 void terrain_setup(void) {
-    terrain_image_setup();
-
-    // Add all of the terrain to the game world (need to fill the arrays before we can do collision checking)
-    for(int i=0; i<NUM_TERRAIN; i++) {
-        // Choose a type of terrain to spawn
-        int type = rand() % NUM_TERRAIN_TYPES;
-        // We don't care what the coordinates are for now
-        int x = -10;
-        int y = -20;
-        // Create the terrain sprite
-        sprite_init(&terrain[i], x, y, terrain_image[type].width, terrain_image[type].height, terrain_image[type].bitmap);
-    }
-
     // Reset all of the terrain so they appear in the playing area 
-    for(int i=0; i<NUM_TERRAIN; i++) {
-        int y_bot = rand() % (LCD_Y - 3);
+    for(uint8_t i=FIRST_TERRAIN; i<FIRST_TERRAIN+NUM_TERRAIN; i++) {
+        int y_bot = random_below(RANDOM_TERRAIN, LCD_Y - 3);
         terrain_reset(i, y_bot);
     }
 }
 
 /**
  * Moves the specified terrain to the y-coordinate give but will randomise the x-coordinate. Will randomise the terrain type
+ * If the terrain would overlap anything it is left out of the game world and tried again next step.
+ * index - the terrain's index in the obstacle pool
  * ybot - the sprite's bottom pixel y-coordinate
  **/
-void terrain_reset(int index, int y_bot) {
+void terrain_reset(uint8_t index, int y_bot) {
     // Choose a new terrain type
-    int type = rand() % NUM_TERRAIN_TYPES;
-    int width = terrain_image[type].width;
-    int height = terrain_image[type].height;
+    uint8_t type = TERRAIN_TREE + random_below(RANDOM_TERRAIN, NUM_TERRAIN_TYPES);
+    Image image;
+    image_read(&image, obstacle_images, type);
+    int width = image.width;
+    int height = image.height;
 
     // Minimum space from the road the terrain can spawn
-    int padding = height / ROAD_CURVE_MIN;
+    int padding = height / LEVEL_ROAD_CURVE_MIN;
     // Place the terrain at the y-coordinate
 	int y = y_bot - height;
 
     // Check if we'll place the terrain on the left or right side of the road
-	bool left = rand() % 2;
+	bool left = random_below(RANDOM_TERRAIN, 2);
     // Check if there is any space to place the terrain (due to the road curving)
     if(left) {
         // If there's no space in the left side of the road, place it on the right side
-        if(road[y_bot] - width - padding <= DASHBOARD_BORDER_X) {
+        if(road_x(y_bot) - width - padding <= DASHBOARD_BORDER_X) {
             left = false;
         }
     } else {
         // If there's no space in the right side of the road, place it on the left side
-        if(road[y_bot] + road_width + width + padding >= LCD_X - 1) {
+        if(road_x(y_bot) + game.road_width + width + padding >= LCD_X - 1) {
             left = true;;
         }
     }
-    // Find the x coordinate for the new terrain
-	int x = -1 - width;
+    // Find the range of x coordinates for the new terrain
+	int min_x, max_x;
 	if(left) {
-		int min_x = DASHBOARD_BORDER_X + 1;
-		int max_x = road[y_bot] - width - padding - 1;
-		x = rand() % (max_x + 1 - min_x) + min_x;
+		min_x = DASHBOARD_BORDER_X + 1;
+		max_x = road_x(y_bot) - width - padding - 1;
 	} else {
-		int min_x = road[y_bot] + road_width + padding + 1;
-		int max_x = LCD_X - 2 - width;
-		x = rand() % (max_x + 1 - min_x) + min_x;
+		min_x = road_x(y_bot) + game.road_width + padding + 1;
+		max_x = LCD_X - 2 - width;
 	}
 
-    // Update the sprite's details
-    terrain[index].bitmap = terrain_image[type].bitmap;
-    terrain[index].x = x;
-    terrain[index].y = y;
-    terrain[index].width = width;
-    terrain[index].height = height;
-
-    // Check if there is any collision with other terrain
-    bool collision = false;
-	for(int i=0; i<NUM_TERRAIN; i++) {
-		// We don't want to check if it is colliding with itself
-		if(index != i) {
-			if(check_sprite_collided(terrain[index],terrain[i])) {
-				collision = true;
-			}
+    // Update the obstacle's details (leaving it out of the game world if there's no room on
+    // either side of the road)
+    obstacle_remove(index);
+    if(max_x < min_x) {
+        return;
+    }
+	int x = min_x + random_below(RANDOM_TERRAIN, max_x + 1 - min_x);
+    game.obstacle_type[index] = type;
+    game.obstacle_x[index] = x;
+    game.obstacle_y[index] = y;
+
+    // Check if there is any collision with other terrain in the same bands
+    ObstacleMask nearby = bands_query(y, height) & TERRAIN_MASK;
+	for(uint8_t i=0; nearby != 0; i++, nearby >>= 1) {
+		if((nearby & 1) && check_obstacle_collided(i, x, y, &image)) {
+			return;
 		}
 	}
     // Check if there is collision with the fuel station
-    if(check_sprite_collided(terrain[index], fuel_station)) {
-        collision = true;   
+    if(check_fuel_station_collided(x, y, &image)) {
+        return;
     }
 
-    if(collision) {
-        // Place the terrain on the bottom of the screen
-        terrain[index].y = LCD_Y + 1;
-    }
+    game.obstacle_active |= OBSTACLE_BIT(index);
+    bands_insert(index);
 }
 
 
@@ -1079,58 +1707,44 @@ void terrain_reset(int index, int y_bot) {
  * Moves the terrain downwards proportionally to the current speed
  **/
 void terrain_step(void) {
-    for(int i=0; i<NUM_TERRAIN; i++) {
-        terrain[i].y++;
-        // Reset the terrain if it has gone out of bounds
-        if(terrain[i].y > LCD_Y) {
-            terrain_reset(i,0);
+    ObstacleMask bit = OBSTACLE_BIT(FIRST_TERRAIN);
+    for(uint8_t i=FIRST_TERRAIN; i<FIRST_TERRAIN+NUM_TERRAIN; i++, bit <<= 1) {
+        if(game.obstacle_active & bit) {
+            game.obstacle_y[i]++;
+            bands_move(i, game.obstacle_y[i] - 1);
+            if(game.obstacle_y[i] <= LCD_Y) {
+                continue;
+            }
         }
+        // Reset the terrain if it has gone out of bounds (or couldn't be placed last time)
+        terrain_reset(i, 0);
     }
 }
 
 /**
- * Create the sprites which hold the bitmap information about each hazard type
- **/
-void hazard_image_setup(void){
-    // Setup the tree bitmap
-    sprite_init(&hazard_image[HAZARD_TRIANGLE], -1, -1, hazard_triangle_width, hazard_triangle_height, hazard_triangle_image);
-    // Setup the sign bitmap
-    sprite_init(&hazard_image[HAZARD_SPIKE], -1, -1, hazard_spike_width, hazard_spike_height, hazard_spike_image);
-}
-
-/**
- * Initialises the hazard array by setting each hazard sprite in the game world. 
+ * Places all of the hazards in the game world
  **/
 void hazard_setup(void) {
-    hazard_image_setup();
-
-    // Add all of the hazards to the game world (need to fill the arrays before we can do collision checking)
-    for(int i=0; i<NUM_HAZARD; i++) {
-        // Choose a type of hazard to spawn
-        int type = rand() % NUM_HAZARD_TYPES;
-        // We don't care what the coordinates are for now
-        int x = -10;
-        int y = -20;
-        // Create the hazard sprite
-        sprite_init(&hazard[i], x, y, hazard_image[type].width, hazard_image[type].height, hazard_image[type].bitmap);
-    }
-
     // Reset all of the hazards so they appear in the playing area 
-    for(int i=0; i<NUM_HAZARD; i++) {
-        int y_bot = rand() % (LCD_Y - 20);
+    for(uint8_t i=FIRST_HAZARD; i<FIRST_HAZARD+NUM_HAZARD; i++) {
+        int y_bot = random_below(RANDOM_HAZARD, LCD_Y - 20);
         hazard_reset(i, y_bot);
     }
 }
 
 /**
  * Moves the specified hazard to the y coordinate given but will randomise the x-coordinate. Will randomise the hazard type
+ * If the hazard would overlap another hazard it is left out of the game world until it spawns again.
+ * index - the hazard's index in the obstacle pool
  * ybot - the sprite's bottom pixel y-coordinate
  **/
-void hazard_reset(int index, int y_bot) {
+void hazard_reset(uint8_t index, int y_bot) {
     // Choose a new hazard type
-    int type = rand() % NUM_HAZARD_TYPES;
-    int width = hazard_image[type].width;
-    int height = hazard_image[type].height;
+    uint8_t type = HAZARD_TRIANGLE + random_below(RANDOM_HAZARD, NUM_HAZARD_TYPES);
+    Image image;
+    image_read(&image, obstacle_images, type);
+    int width = image.width;
+    int height = image.height;
 
     // Minimum space from the road the hazard can spawn
     int padding = 1;
@@ -1138,92 +1752,89 @@ void hazard_reset(int index, int y_bot) {
 	int y = y_bot - height;
 
     // Find the x coordinate for the new hazard
-    int min_x = road[y_bot] + padding; 
-    int max_x = road[y_bot] + road_width - width - padding;
-	int x = rand() % (max_x + 1 - min_x) + min_x;
+    int min_x = road_x(y_bot) + padding; 
+    int max_x = road_x(y_bot) + game.road_width - width - padding;
+	int x = min_x + random_below(RANDOM_HAZARD, max_x + 1 - min_x);
     
-    // Update the sprite's details
-    hazard[index].bitmap = hazard_image[type].bitmap;
-    hazard[index].x = x;
-    hazard[index].y = y;
-    hazard[index].width = width;
-    hazard[index].height = height;
-
-    // Check if there is any collision with other hazards
-    bool collision = false;
-	for(int i=0; i<NUM_HAZARD; i++) {
-		// We don't want to check if it is colliding with itself
-		if(index != i) {
-			if(check_sprite_collided(hazard[index],hazard[i])) {
-				collision = true;
-			}
+    // Update the obstacle's details
+    obstacle_remove(index);
+    game.obstacle_type[index] = type;
+    game.obstacle_x[index] = x;
+    game.obstacle_y[index] = y;
+
+    // Check if there is any collision with other hazards in the same bands
+    ObstacleMask nearby = bands_query(y, height) & HAZARD_MASK;
+	for(uint8_t i=0; nearby != 0; i++, nearby >>= 1) {
+		if((nearby & 1) && check_obstacle_collided(i, x, y, &image)) {
+			return;
 		}
 	}
 
-    if(collision) {
-        // Place the hazards on the bottom of the screen
-        hazard[index].y = LCD_Y + 1;
-    }
+    game.obstacle_active |= OBSTACLE_BIT(index);
+    bands_insert(index);
 }
 
 /**
  * Moves the hazards downwards proportionally to the current speed
  **/
 void hazard_step(void) {
-    for(int i=0; i<NUM_HAZARD; i++) {
-        hazard[i].y++;
-        // Reset the terrain if it has gone out of bounds
-        if(hazard[i].y > LCD_Y) {
-            int roll = rand() % 100;
-            // Randomise whether it will actually spawn
-            if(roll < HAZARD_SPAWN_CHANCE) {
-                hazard_reset(i,0);
+    ObstacleMask bit = OBSTACLE_BIT(FIRST_HAZARD);
+    for(uint8_t i=FIRST_HAZARD; i<FIRST_HAZARD+NUM_HAZARD; i++, bit <<= 1) {
+        if(game.obstacle_active & bit) {
+            game.obstacle_y[i]++;
+            bands_move(i, game.obstacle_y[i] - 1);
+            if(game.obstacle_y[i] <= LCD_Y) {
+                continue;
             }
+            // The hazard has gone out of bounds
+            obstacle_remove(i);
+        }
+
+        // Randomise whether it will actually spawn
+        if(random_chance(RANDOM_HAZARD, LEVEL_HAZARD_SPAWN_THRESHOLD)) {
+            hazard_reset(i,0);
         }
     }
 }
 
 /**
- * Chooses a new location at the top of the screen to spawn the fuel station, will also make 
- * sure the road remains straight in the area. 
+ * Chooses a new location at the top of the screen to spawn the fuel station. Called by
+ * road_step() when the straight section reserved for it starts.
  **/
 void fuel_station_reset(void) {
     // Add the fuel station a bit above the screen
-    double y = 0 - fuel_station_height - 3;
- 
-    // Keep the road straight while the fuel station is spawned
-    road_direction = ROAD_STRAIGHT;
-    road_section_length = fuel_station_height + 6;
+    int y = 0 - FUEL_STATION_HEIGHT - 3;
 
     // Choose the side of the road to spawn
-    bool left = rand() % 2;
+    bool left = random_below(RANDOM_FUEL, 2);
     if(left) {
         // If there's no space in the left side of the road, place it on the right side
-        if(road[0] - fuel_station_width <= DASHBOARD_BORDER_X) {
+        if(road_x(0) - FUEL_STATION_WIDTH <= DASHBOARD_BORDER_X) {
             left = false;
         }
     } else {
         // If there's no space in the right side of the road, place it on the left side
-        if(road[0] + road_width + fuel_station_width >= LCD_X - 1) {
+        if(road_x(0) + game.road_width + FUEL_STATION_WIDTH >= LCD_X - 1) {
             left = true;;
         }
     }
 
     // Choose the x-coordinate depending on which side of the road we're spawning
-    double x;
+    int x;
     if(left) {
-        x = road[0] - fuel_station_width + 1;
+        x = road_x(0) - FUEL_STATION_WIDTH + 1;
     } else {
-        x = road[0] + road_width;
+        x = road_x(0) + game.road_width;
     }
 
     // Change the location of the fuel station
-    fuel_station.x = x;
-    fuel_station.y = y;
+    game.fuel_station_x = x;
+    game.fuel_station_y = y;
 
     // Check if there is a terrain in the way and remove it
-    for(int i=0; i<NUM_TERRAIN; i++) {
-        if(check_sprite_collided(fuel_station, terrain[i])) {
+    ObstacleMask nearby = bands_query(y, FUEL_STATION_HEIGHT) & TERRAIN_MASK;
+    for(uint8_t i=0; nearby != 0; i++, nearby >>= 1) {
+        if((nearby & 1) && check_obstacle_collided(i, x, y, &fuel_station_sprite)) {
             terrain_reset(i, 0);
         }
     }
@@ -1234,20 +1845,22 @@ void fuel_station_reset(void) {
  * fuel station when necessary
  **/
 void fuel_station_step(void) {
-    fuel_station_counter--;
+    game.fuel_station_counter--;
 
     // Check if it's time to respawn the new fuel station
-    if(fuel_station_counter < 0) {
+    if(game.fuel_station_counter < 0) {
         // Make sure the current fuel station has already gone out of bounds
-        if(fuel_station.y > LCD_Y) {
-            // Reset the location of the fuel station
-            fuel_station_reset();
-            fuel_station_counter = rand() % (FUEL_STAION_MAX + 1 - FUEL_STATION_MIN) + FUEL_STATION_MIN;
+        if(game.fuel_station_y > LCD_Y) {
+            // Spawn the fuel station once the road has a straight section for it
+            road_reserve_straight(FUEL_STATION_STRAIGHT);
+            game.fuel_station_counter = LEVEL_FUEL_STATION_MIN + random_below(RANDOM_FUEL, LEVEL_FUEL_STATION_RANGE);
         }
     }
 
-    // Scroll the fuel station
-    fuel_station.y++;
+    // Scroll the fuel station until it is below the screen
+    if(game.fuel_station_y < FUEL_STATION_GONE) {
+        game.fuel_station_y++;
+    }
 }
 
 /**
@@ -1255,12 +1868,12 @@ void fuel_station_step(void) {
  **/
 void check_refuel(void) {
 	// Check if the player is directly to the left or right of the fuel station
-	if((player.x + player.width == fuel_station.x) || (fuel_station.x + fuel_station.width == player.x)) {
+	if((game.player_x + CAR_WIDTH == game.fuel_station_x) || (game.fuel_station_x + FUEL_STATION_WIDTH == game.player_x)) {
         // Check if the player is inside the bounds of the fuel station
-        if((player.y >= fuel_station.y) && (player.y + player.height <= fuel_station.y + fuel_station.height)) {
-            if((speed < 3) && controls_states[DECEL]) {
-			    refuelling = true;
-		        speed = 0;
+        if((PLAYER_Y >= game.fuel_station_y) && (PLAYER_Y + CAR_HEIGHT <= game.fuel_station_y + FUEL_STATION_HEIGHT)) {
+            if((game.speed < FIX16_FROM_INT(3)) && CONTROL_HELD(DECEL)) {
+			    game.refuelling = true;
+		        game.speed = 0;
 		    }
         }
 	}
@@ -1270,18 +1883,14 @@ void check_refuel(void) {
  * Refuels the car in increments. Full fuel tank will be achieved in 3 seconds
  **/
 void refuel(void) {
-	if(refuelling) {
+	if(game.refuelling) {
         // Cancel refuelling if the car starts moving again or brake is released
-		if(speed > 0 || !controls_states[DECEL]) {
-			refuelling = false;
+		if(game.speed > 0 || !CONTROL_HELD(DECEL)) {
+			game.refuelling = false;
 		} else {
-            // Increment the fuel value with a rate that would go 0-100 in 3 seconds
-            fuel += 1.7;
-
-            // Prevent overshoot and cancel fuelling if reached max fuel
-            if(fuel > FUEL_MAX) {
-                fuel = FUEL_MAX;
-                refuelling = false;
+            // Cancel fuelling if reached max fuel
+            if(physics_refuel()) {
+                game.refuelling = false;
             }
         }
 	} else {
@@ -1290,14 +1899,14 @@ void refuel(void) {
 }
 
 /**
- * Checks if the sprite is off the road
+ * Checks if something width pixels wide at (x, y) is off the road
  **/
-bool offroad(Sprite sprite) {
-    if(sprite.x < road[(int)round(sprite.y)]) {
+bool offroad(int x, int y, uint8_t width) {
+    if(x < road_x(y)) {
 		return true;
 	}
 
-	if((sprite.x + sprite.width - 1) > (road[(int)round(sprite.y)] + road_width)) {
+	if((x + width - 1) > (road_x(y) + game.road_width)) {
 		return true;
 	}
 
@@ -1305,98 +1914,177 @@ bool offroad(Sprite sprite) {
 }
 
 /**
- * Checks if there is any terrain, hazard or fuel station colliding with the sprite.
+ * Returns the band that the row y is part of
  **/
-bool check_collision(Sprite sprite) {
-	// Iterate through the terrain to see if there was a collision
-	for(int i=0; i<NUM_TERRAIN; i++) {
-		// We don't want to check if it is colliding with itself
-		if(&sprite != &terrain[i]) {
-			if(check_sprite_collided(sprite,terrain[i])) {
-				return true;
-			}
-		}
-	}
-
-	// Iterate through the hazards to see if there was a collision
-	for(int i=0; i<NUM_HAZARD; i++) {
-		// We don't want to check if it is colliding with itself
-		if(&sprite != &hazard[i]) {
-			if(check_sprite_collided(sprite,hazard[i])) {
-				return true;
-			}
-		}
-	}
+uint8_t band_of(int y) {
+    if(y < BAND_TOP) {
+        return 0;
+    } else if(y >= BAND_TOP + NUM_BANDS * BAND_HEIGHT) {
+        return NUM_BANDS - 1;
+    }
+    return (y - BAND_TOP) / BAND_HEIGHT;
+}
 
-	// Check if collides with fuel station
-	if(check_sprite_collided(sprite,fuel_station)) {
-		return true;
-	}
+/**
+ * Records the obstacle in every band it covers
+ **/
+void bands_insert(uint8_t index) {
+    int y = game.obstacle_y[index];
+    ObstacleMask bit = OBSTACLE_BIT(index);
+    for(uint8_t band = band_of(y); band <= band_of(y + obstacle_height(index) - 1); band++) {
+        obstacle_bands[band] |= bit;
+    }
+}
 
-	return false;
+/**
+ * Removes the obstacle from every band it covers
+ **/
+void bands_remove(uint8_t index) {
+    int y = game.obstacle_y[index];
+    ObstacleMask bit = OBSTACLE_BIT(index);
+    for(uint8_t band = band_of(y); band <= band_of(y + obstacle_height(index) - 1); band++) {
+        obstacle_bands[band] &= ~bit;
+    }
 }
 
 /**
- * Checks if the two sprites collide with each other
+ * Updates the bands of an obstacle that has moved vertically from old_y. Nothing needs to be 
+ * done unless the obstacle's top or bottom row has moved into a different band.
  **/
-bool check_sprite_collided(Sprite sprite1, Sprite sprite2) {
-    // Check if both sprites are valid
-	if((&sprite1 != NULL) && (&sprite2 != NULL)) {
-		// Check if there is colllision in the x-axis
-		if(!((sprite1.x + sprite1.width <= sprite2.x) || (sprite1.x >= sprite2.x + sprite2.width))) {
-			// Check if there is collision in the y-axis
-			if(!((sprite1.y + sprite1.height < sprite2.y) || (sprite1.y > sprite2.y + sprite2.height))) {
-				return check_sprite_collided_pixel(sprite1, sprite2);
-			}
-		}
-	}
+void bands_move(uint8_t index, int old_y) {
+    int y = game.obstacle_y[index];
+    int height = obstacle_height(index);
+    if((band_of(old_y) == band_of(y)) && (band_of(old_y + height - 1) == band_of(y + height - 1))) {
+        return;
+    }
 
-	return false;
+    ObstacleMask bit = OBSTACLE_BIT(index);
+    for(uint8_t band = band_of(old_y); band <= band_of(old_y + height - 1); band++) {
+        obstacle_bands[band] &= ~bit;
+    }
+    for(uint8_t band = band_of(y); band <= band_of(y + height - 1); band++) {
+        obstacle_bands[band] |= bit;
+    }
 }
 
-bool check_sprite_collided_pixel(Sprite sprite1, Sprite sprite2) {
-    /*
-    int y1 = (int)round(sprite1.y);
-    int y2 = (int)round(sprite2.y);
-    int x1 = (int)round(sprite1.x);
-    int x2 = (int)round(sprite2.x);
-
-    for(int dx = 0; dx < sprite1.width; dx++) {
-        for(int dy = 0; dy < sprite1.height; dy++) {
-            int x = x1 + dx;
-            int y = y1 + dy;
-
-            if((x > x2) && (x < (x2 + sprite2.width))) {
-                if((y > y2) && (y < (y2 + sprite2.height))) {
-                    if((sprite1.bitmap[(int) (dy + dx / 8)] >> (7 - dx % 8)) & 1) {
-                        int dx2 = x2 - x;
-                        int dy2 = y2 - y;
-                        if((sprite2.bitmap[(int) (dy2 + dx2 / 8)] >> (7 - dx2 % 8)) & 1) {
-                            return true;
-                        }
-                    }
-                }
-            }
+/**
+ * Records every active obstacle in their bands from scratch
+ **/
+void bands_rebuild(void) {
+    memset(obstacle_bands, 0, sizeof(obstacle_bands));
+
+    ObstacleMask active = game.obstacle_active;
+    for(uint8_t i=0; active != 0; i++, active >>= 1) {
+        if(active & 1) {
+            bands_insert(i);
         }
-    }*/
+    }
+}
 
-    return true;
+/**
+ * Returns the obstacles that share a band with any of the rows from y to y+height-1
+ **/
+ObstacleMask bands_query(int y, uint8_t height) {
+    ObstacleMask nearby = 0;
+    for(uint8_t band = band_of(y); band <= band_of(y + height - 1); band++) {
+        nearby |= obstacle_bands[band];
+    }
+    return nearby;
 }
 
 /**
- * Changes the speed to zero, reduces car condition and resets the player to the middle of the road
+ * Checks if there is any terrain, hazard or fuel station colliding with an image at (x, y).
  **/
-void handle_collision(void) {
-	speed = 0;
-	fuel = FUEL_MAX;
-	condition -= 20;
-	if(condition <= 0) {
-		change_screen(GAMEOVER_SCREEN);
+bool check_collision(int x, int y, const Image * image) {
+	// Iterate through the obstacles in the same bands to see if there was a collision
+	ObstacleMask nearby = bands_query(y, image->height);
+	for(uint8_t i=0; nearby != 0; i++, nearby >>= 1) {
+		if((nearby & 1) && check_obstacle_collided(i, x, y, image)) {
+			return true;
+		}
+	}
+
+	// Check if collides with fuel station
+	return check_fuel_station_collided(x, y, image);
+}
+
+/**
+ * Checks if the fuel station collides with an image at (x, y)
+ **/
+bool check_fuel_station_collided(int x, int y, const Image * image) {
+	return check_image_collided(game.fuel_station_x, game.fuel_station_y, &fuel_station_sprite, x, y, image);
+}
+
+/**
+ * Checks if the obstacle collides with an image at (x, y)
+ **/
+bool check_obstacle_collided(uint8_t index, int x, int y, const Image * image) {
+	Image obstacle;
+	image_read(&obstacle, obstacle_images, game.obstacle_type[index]);
+	return check_image_collided(game.obstacle_x[index], game.obstacle_y[index], &obstacle, x, y, image);
+}
+
+/**
+ * Checks if two images with their top left corners at (x1, y1) and (x2, y2) collide
+ **/
+bool check_image_collided(int x1, int y1, const Image * image1, int x2, int y2, const Image * image2) {
+	// Check if there is colllision in the x-axis
+	if((x1 + image1->width <= x2) || (x1 >= x2 + image2->width)) {
+		return false;
+	}
+	// Check if there is collision in the y-axis
+	if((y1 + image1->height <= y2) || (y1 >= y2 + image2->height)) {
+		return false;
+	}
+
+	return check_sprite_collided_pixel(image1->bitmap, x1, y1, image1->height, image2->bitmap, x2, y2, image2->height);
+}
+
+/**
+ * Checks if any set pixels of two overlapping bitmaps (in flash) are in the same place. Every sprite is at
+ * most 8 pixels wide, so each row of a bitmap is one byte which can be used as the mask of
+ * that row (the unused low bits are always clear). The overlapping rows are lined up by
+ * shifting the right hand row and ANDed together.
+ * The bounding boxes of the bitmaps given must overlap.
+ **/
+bool check_sprite_collided_pixel(const uint8_t * rows1, int x1, int y1, uint8_t height1,
+                                 const uint8_t * rows2, int x2, int y2, uint8_t height2) {
+	// Make sure the first bitmap is the left one so we only have to shift right
+	if(x2 < x1) {
+		return check_sprite_collided_pixel(rows2, x2, y2, height2, rows1, x1, y1, height1);
+	}
+	uint16_t shift = pgm_read_word(&collision_shift[x2 - x1]);
+
+	// Find the rows where both bitmaps overlap
+	int top = (y1 > y2) ? y1 : y2;
+	int bottom = ((y1 + height1) < (y2 + height2)) ? (y1 + height1) : (y2 + height2);
+	rows1 += top - y1;
+	rows2 += top - y2;
+
+	for(int y = top; y < bottom; y++) {
+		uint8_t row2 = (uint16_t)(pgm_read_byte(rows2++) * shift) >> 8;
+		if(pgm_read_byte(rows1++) & row2) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Changes the speed to zero, reduces car condition and resets the player to the middle of the road
+ **/
+void handle_collision(void) {
+	game.speed = 0;
+	game.fuel = FIX8(FUEL_MAX);
+	game.condition -= 20;
+	if(game.condition <= 0) {
+		change_screen(GAMEOVER_SCREEN);
 	}
 	
     // Test: Collision Test plan 1
     //char buffer[200];
-    //usb_send_message(DEBUG, 6, buffer, 200, "Time step: %.3f\nCar x: %.0f\nCar x2: %.0f\nObject x: %.0f\nObject x2: %.0f\nCollided: %d\n%d\n", time_paused, player.x, player.x+player.width, hazard[0].x, hazard[0].width + hazard[0].x, check_sprite_collided(player, hazard[0]), 0);
+    //usb_send_message(DEBUG, 6, buffer, 200, "Time step: %.3f\nCar x: %.0f\nCar x2: %.0f\nObject x: %.0f\nObject x2: %.0f\nCollided: %d\n%d\n", time_paused, player.x, player.x+player.width, hazard[0].x, hazard[0].width + hazard[0].x, check_sprite_collided(&player, &hazard[0]), 0);
 
     // Put the player in the middle of the road again
     player_car_reset();
@@ -1406,55 +2094,172 @@ void handle_collision(void) {
     //usb_send_message(DEBUG, 6, buffer, 200, "Time step: %.3f\nCar x: %.0f\nCar x2: %.0f\nCar y: %.0f\nObject y: %.0f\nCondition: %d\n%d\n", time_paused, player.x, player.x+player.width, player.y, fuel_station.y, condition, 0);
 
 
-	// Remove any hazards up to a car length above the player
-	for(int i=0; i<NUM_HAZARD; i++) {
-		if(hazard[i].y + hazard[i].height > player.y - player.height) {
+	// Remove any hazards up to a car length above the player (and respawn any waiting to)
+	for(uint8_t i=FIRST_HAZARD; i<FIRST_HAZARD+NUM_HAZARD; i++) {
+		if(!(game.obstacle_active & OBSTACLE_BIT(i)) || (game.obstacle_y[i] + obstacle_height(i) > PLAYER_Y - CAR_HEIGHT)) {
             hazard_reset(i, 0);
         }
 	}
 }
 
 /**
- * Pass game identifying variables such as current speed, distance, condition, fuel, etc to the server via USB 
+ * Sends a snapshot of the game to the server via USB in SAVE_FRAME_SIZE frames
  **/
 void game_state_save(void) {
-    //uint8_t condition;
-    //double speed;
-    //double fuel;
-    //double distance;
-    //uint16_t game_timer_counter;
-    // Road
-    //uint8_t road[LCD_Y];            // The x-coordinates of each road piece
-    //uint8_t road_counter;           // Counts how many steps the road has taken before being moved horizontally
-    //uint8_t road_curve;             // This decides how many times the road must move before it is moved horizontally
-    //int road_direction;
-    //uint8_t road_section_length;    // How many steps the road has taken in the current length
-    // The player
-    //Sprite player;
-    //Sprite terrain[NUM_TERRAIN];   
-    //Sprite hazard[NUM_HAZARD];  
-    // Fuel station
-    //Sprite fuel_station;
-    //double fuel_station_counter;   // Counts down to when the fuel station can spawn again
-    char data[500];
-    usb_send_message(SAVE, 15, data, 500, "%d\n%.0f\n%.0f\n%d\n%d\n%d\n%.3f\n%d\n%d\n%d\n%d\n%d\n%d\n%d\n%.3f\n%d\n", 
-                                        condition, speed, fuel, distance, game_timer_counter, &road, road_counter, road_curve, road_direction, road_section_length, &player,
-                                        &terrain, &hazard, &fuel_station, fuel_station_counter, 0);
+    SaveImage * image = &save_buffer.image;
+
+    // Clear the buffer so the padding in the last frame is always zero
+    memset(&save_buffer, 0, sizeof(save_buffer));
+    image->header.magic = SAVE_MAGIC;
+    image->header.version = SAVE_VERSION;
+    image->header.length = sizeof(SaveState);
+    image->state.game = game;
+    image->state.game_timer_counter = clock_overflows();
+    memcpy(image->state.split_ticks, split_ticks, sizeof(split_ticks));
+    image->crc = save_crc(image);
+
+    // Let any telemetry message that has been started finish so they don't get mixed up
+    telemetry_finish();
+    usb_serial_putchar(SAVE);
+    usb_serial_putchar(SAVE_NUM_FRAMES);
+    for(uint8_t frame = 0; frame < SAVE_NUM_FRAMES; frame++) {
+        usb_serial_write(save_buffer.frames[frame], SAVE_FRAME_SIZE);
+    }
     usb_serial_flush_output();
-    usb_serial_flush_input();
 }
 
 /**
- * Communicate with the server via USB in order to load a game by getting critical variables
+ * Continues the game from a copy of its state. The state can come from the server, so
+ * anything that could make the game read or draw outside of its arrays is put back in range
+ * (a save that passed its CRC check should never need it).
+ **/
+void game_state_restore(const GameState * state) {
+    game = *state;
+
+    if(game.road_head >= LCD_Y) {
+        game.road_head = 0;
+    }
+    // The road is drawn straight into the screen buffer, so it has to stay on the screen
+    if(game.road_width >= LCD_X - DASHBOARD_BORDER_X - 2) {
+        game.road_width = LEVEL_ROAD_WIDTH;
+    }
+    for(uint8_t y = 0; y < LCD_Y; y++) {
+        if(game.road[y] + game.road_width >= LCD_X) {
+            game.road[y] = LCD_X - 1 - game.road_width;
+        }
+    }
+    if((game.road_queue_head >= ROAD_QUEUE_LENGTH) || (game.road_queue_count > ROAD_QUEUE_LENGTH)) {
+        game.road_queue_head = 0;
+        game.road_queue_count = 0;
+    }
+    for(uint8_t stream = 0; stream < NUM_RANDOM_STREAMS; stream++) {
+        if(game.random_state[stream] == 0) {
+            game.random_state[stream] = pgm_read_word(&random_stream_keys[stream]);
+        }
+    }
+
+    game.obstacle_active &= TERRAIN_MASK | HAZARD_MASK;
+    for(uint8_t i = 0; i < NUM_OBSTACLES; i++) {
+        if(game.obstacle_type[i] >= NUM_OBSTACLE_TYPES) {
+            game.obstacle_type[i] = (i < FIRST_HAZARD) ? TERRAIN_TREE : HAZARD_TRIANGLE;
+        }
+    }
+    bands_rebuild();
+}
+
+/**
+ * Asks the server for the last save. The reply is received by game_state_load_step()
+ * over the next few frames, and the game will continue (paused) from the save once it
+ * has all arrived.
  **/
 void game_state_load(void) {
+    // The loaded game didn't come from the seed, so it can't be replayed
+    REPLAY_RECORD_STOP(REPLAY_LOADED);
+
+    // Throw away anything left over from an earlier message
+    usb_serial_flush_input();
+
+    telemetry_finish();
+    usb_serial_putchar(LOAD);
+    usb_serial_flush_output();
+
+    load_state = LOAD_WAITING;
+    load_received = 0;
+    load_timeout = LOAD_TIMEOUT;
+}
+
+/**
+ * Receives up to LOAD_BYTES_PER_STEP bytes of the save requested by game_state_load() 
+ * without waiting for any more to arrive. Once the whole save has been received and
+ * checked, the game is restored from it. 
+ **/
+void game_state_load_step(void) {
+    if(--load_timeout == 0) {
+        load_state = LOAD_IDLE;
+        return;
+    }
+
+    // The reply starts with the LOAD command and the number of frames that follow
+    if(load_state == LOAD_WAITING) {
+        int16_t command = usb_serial_getchar();
+        if(command < 0) {
+            return;
+        } else if(command != LOAD) {
+            load_state = LOAD_IDLE;
+            return;
+        }
+        load_state = LOAD_HEADER;
+    }
+    if(load_state == LOAD_HEADER) {
+        int16_t num_frames = usb_serial_getchar();
+        if(num_frames < 0) {
+            return;
+        } else if(num_frames != SAVE_NUM_FRAMES) {
+            // The server has no save for us (or it's from another version)
+            load_state = LOAD_IDLE;
+            return;
+        }
+        load_expected = num_frames * SAVE_FRAME_SIZE;
+        load_state = LOAD_RECEIVING;
+    }
 
+    // Copy whatever has arrived straight into the save buffer
+    uint8_t * buffer = (uint8_t *)&save_buffer;
+    for(uint8_t i = 0; (i < LOAD_BYTES_PER_STEP) && (load_received < load_expected); i++) {
+        int16_t data = usb_serial_getchar();
+        if(data < 0) {
+            return;
+        }
+        buffer[load_received++] = data;
+    }
+    if(load_received < load_expected) {
+        return;
+    }
+
+    load_state = LOAD_IDLE;
+    const SaveImage * image = &save_buffer.image;
+    if((image->header.magic != SAVE_MAGIC) || (image->header.version != SAVE_VERSION) ||
+            (image->header.length != sizeof(SaveState)) || (image->crc != save_crc(image))) {
+        return;
+    }
+
+    // Continue the loaded game paused so the player can get ready (the checkpoints were of
+    // the game it replaced)
+    game_state_restore(&image->state.game);
+    clock_set(image->state.game_timer_counter);
+    memcpy(split_ticks, image->state.split_ticks, sizeof(split_ticks));
+    splits_restore();
+    checkpoint_reset();
+    game_paused = 1;
+    time_paused = clock_ms();
+    game_screen = GAME_SCREEN;
 }
 
 /**
  * Sends the string input to the terminal
  **/
 void usb_send_message(enum USBCommand command, int line_num ,char * buffer, int buffer_size, const char * format, ...) {
+    telemetry_finish();
     usb_serial_putchar(command);
     usb_serial_putchar(line_num);
     va_list args;
@@ -1469,6 +2274,7 @@ void usb_send_message(enum USBCommand command, int line_num ,char * buffer, int
 void teensy_setup(void) {
     set_clock_speed(CPU_8MHz);
     lcd_init(LCD_DEFAULT_CONTRAST);
+    lcd_contrast = LCD_DEFAULT_CONTRAST;
 
     // Setup the ADC that will be used for the potentionmeters
     adc_init();
@@ -1485,10 +2291,20 @@ void teensy_setup(void) {
     TCCR0B = 1<<CS02;
     TIMSK0 = 1<<TOIE0; 
 
-    // Initialise Timer 3 which will be used to control speed
+    // Initialise Timer 1 which will be used to control speed and start each frame
     TCCR1B = 0x0C;	        // Prescaler 1024, enable CTC
 	TIMSK1 = 0x02;          // Interrupt on 
-	OCR1A = TIMER1_FREQ/60;
+	OCR1A = TIMER1_FREQ/loop_freq;
+
+    // Wait for interrupts in idle sleep, which keeps the timers and USB running
+    set_sleep_mode(SLEEP_MODE_IDLE);
+
+#ifdef PROFILE
+    // Run Timer 3 freely with a prescaler of 8 (1us a tick) for timing the game loop
+    TCCR3A = 0x00;
+    TCCR3B = 1<<CS31;
+    profile_reset();
+#endif
 
     // Setup the buttons
     DDRF &= ~(1<<BUTTON_LEFT | 1<<BUTTON_RIGHT);
@@ -1498,13 +2314,47 @@ void teensy_setup(void) {
 
     // Enable interrupts
     sei();
+}
+
+/**
+ * Sleeps until the Timer1 interrupt starts the next frame. Other interrupts (such as Timer0 
+ * and USB) wake the CPU up too, so it goes back to sleep until the frame is due. 
+ * Interrupts are turned off while checking the flag so that the tick can't arrive between 
+ * the check and going to sleep (sei() only takes effect after the next instruction).
+ **/
+void frame_wait(void) {
+    cli();
+    while(!frame_due) {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        cli();
+    }
+    frame_due = false;
+    sei();
 } 
 
 void adc_init(void) {
 	// ADC Enable and pre-scaler of 128: ref table 24-5 in datasheet
 	ADCSRA = (1 << ADEN) | (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);
+
+    // Start the filters from a reading of each pot
+    for(uint8_t channel = 0; channel < NUM_ADC_CHANNELS; channel++) {
+        adc_filtered[channel] = adc_read(channel) << ADC_FILTER_SHIFT;
+    }
+
+    // From now on convert a channel every Timer0 overflow, see ISR(ADC_vect)
+    adc_channel = 0;
+    ADMUX = (1 << REFS0);
+    ADCSRB = (1 << ADTS2);                  // Auto trigger on Timer0 overflow
+    ADCSRA |= (1 << ADATE) | (1 << ADIE);   // Auto trigger and interrupt on completion
 }
 
+/**
+ * Waits for a single conversion of the channel. Only used before the ADC is running in the 
+ * background, use adc_value() after that.
+ **/
 uint16_t adc_read(uint8_t channel) {
 	// Select AVcc voltage reference and pin combination.
 	// Low 5 bits of channel spec go in ADMUX(MUX4:0)
@@ -1522,92 +2372,753 @@ uint16_t adc_read(uint8_t channel) {
 	return ADC;
 }
 
-/** ------------------------------------- ISR ------------------------------------- **/
 /**
- * Interrupt that processes Timer0 overflow. 
- * Used for debouncing and elapsed time control
+ * Returns the filtered reading (0-1023) of the channel without waiting for the ADC
  **/
-ISR(TIMER0_OVF_vect) {
-    // Increase the overflow counter in order to calculate how much time has elapsed
-    if(!game_paused && (game_screen == GAME_SCREEN)) {
-        game_timer_counter++;
+uint16_t adc_value(uint8_t channel) {
+    uint16_t filtered;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        filtered = adc_filtered[channel];
     }
+    return filtered >> ADC_FILTER_SHIFT;
+}
 
-    // Increase the overflow counter to control the speed of the game loop
-    loop_counter++;
+/** --------------------------------- CHECKPOINTS --------------------------------- **/
+/**
+ * Forgets every checkpoint and takes the first one of the game that has just started
+ **/
+void checkpoint_reset(void) {
+    checkpoint_valid = false;
+    checkpoint_pool_end = 0;
+    checkpoint_pool_used = 0;
+    checkpoint_first = 0;
+    checkpoint_deltas = 0;
+    checkpoint_take();
+}
 
-    // Observe the same state 6 times before changing the control states
-    uint8_t mask = 0b00111111;
-    // The current state read from the pins for each control
-    uint8_t b;
+/**
+ * Takes a checkpoint of the game. The last one is turned into the delta from this one.
+ **/
+void checkpoint_take(void) {
+    if(checkpoint_valid) {
+        if(checkpoint_deltas == CHECKPOINT_MAX_DELTAS) {
+            checkpoint_drop_oldest();
+        }
+        uint8_t length = checkpoint_encode((const uint8_t *)&game, (const uint8_t *)&checkpoint_latest);
 
-    // BUTTON_LEFT
-    b = (PINF>>BUTTON_LEFT) & 0x01;
-    controls_history[DECEL] = ((controls_history[DECEL] << 1) & mask) | b;
-    if(controls_history[DECEL] == 0) {
-        controls_states[DECEL] = 0;
-    } else if(controls_history[DECEL] == mask) {
-        controls_states[DECEL] = 1;
+        uint8_t index = checkpoint_first + checkpoint_deltas;
+        if(index >= CHECKPOINT_MAX_DELTAS) {
+            index -= CHECKPOINT_MAX_DELTAS;
+        }
+        checkpoint_lengths[index] = length;
+        checkpoint_times[index] = checkpoint_latest_time;
+        checkpoint_deltas++;
     }
 
-    // BUTTON_RIGHT
-    b = (PINF>>BUTTON_RIGHT) & 0x01;
-    controls_history[ACCEL] = ((controls_history[ACCEL] << 1) & mask) | b;
-    if(controls_history[ACCEL] == 0) {
-        controls_states[ACCEL] = 0;
-    } else if(controls_history[ACCEL] == mask) {
-        controls_states[ACCEL] = 1;
+    checkpoint_latest = game;
+    checkpoint_latest_time = clock_overflows();
+    checkpoint_valid = true;
+    checkpoint_counter = 0;
+}
+
+/**
+ * Writes the delta that turns the newer state back into the older one at the end of the
+ * pool and returns its length. Each byte of the delta is added to the newer state without
+ * carrying, so multi-byte fields need no special treatment. A literal only ends at two
+ * unchanged bytes in a row (or after 64 bytes), and the skip that follows is one byte for at
+ * least two, so a delta is never more than CHECKPOINT_DELTA_MAX bytes.
+ **/
+uint8_t checkpoint_encode(const uint8_t * newer, const uint8_t * older) {
+    uint8_t start = checkpoint_pool_end;
+    uint16_t i = 0;
+    while(i < sizeof(GameState)) {
+        uint8_t delta = older[i] - newer[i];
+        bool pair = (delta == 0) && ((i + 1 == sizeof(GameState)) || (older[i + 1] == newer[i + 1]));
+
+        if(pair) {
+            uint8_t count = 0;
+            while((i < sizeof(GameState)) && (older[i] == newer[i]) && (count < 128)) {
+                i++;
+                count++;
+            }
+            // Nothing after the last change needs to be written
+            if(i < sizeof(GameState)) {
+                checkpoint_put(CHECKPOINT_SKIP | (count - 1));
+            }
+        } else if((delta != 0) && (((int8_t)delta >= -32) && ((int8_t)delta < 32))) {
+            checkpoint_put(CHECKPOINT_SMALL | (delta & 0x3F));
+            i++;
+        } else {
+            uint8_t header = checkpoint_put(CHECKPOINT_LITERAL);
+            uint8_t count = 0;
+            while((i < sizeof(GameState)) && (count < 64)) {
+                if((older[i] == newer[i]) && ((i + 1 == sizeof(GameState)) || (older[i + 1] == newer[i + 1]))) {
+                    break;
+                }
+                checkpoint_put(older[i] - newer[i]);
+                i++;
+                count++;
+            }
+            checkpoint_pool[header] = CHECKPOINT_LITERAL | (count - 1);
+        }
     }
 
-    // STICK_CENTRE
-    b = (PINB>>STICK_CENTRE) & 0x01;
-    controls_history[PAUSE] = ((controls_history[PAUSE] << 1) & mask) | b;
-    if(controls_history[PAUSE] == 0) {
-        controls_states[PAUSE] = 0;
-    } else if(controls_history[PAUSE] == mask) {
-        controls_states[PAUSE] = 1;
+    return checkpoint_pool_end - start;
+}
+
+/**
+ * Adds a byte to the end of the pool and returns where it went. The bytes of the oldest delta
+ * come straight after the free space, so it is dropped once they are needed.
+ **/
+uint8_t checkpoint_put(uint8_t data) {
+    if(checkpoint_pool_used == sizeof(checkpoint_pool)) {
+        checkpoint_drop_oldest();
     }
+    checkpoint_pool_used++;
+    uint8_t index = checkpoint_pool_end++;
+    checkpoint_pool[index] = data;
+    return index;
+}
 
-    // STICK_LEFT
-    b = (PINB>>STICK_LEFT) & 0x01;
-    controls_history[MOVE_LEFT] = ((controls_history[MOVE_LEFT] << 1) & mask) | b;
-    if(controls_history[MOVE_LEFT] == 0) {
-         controls_states[MOVE_LEFT] = 0;
-    } else if(controls_history[MOVE_LEFT] == mask) {
-         controls_states[MOVE_LEFT] = 1;
+/**
+ * Forgets the oldest checkpoint
+ **/
+void checkpoint_drop_oldest(void) {
+    checkpoint_pool_used -= checkpoint_lengths[checkpoint_first];
+    checkpoint_first = (checkpoint_first == CHECKPOINT_MAX_DELTAS - 1) ? 0 : (checkpoint_first + 1);
+    checkpoint_deltas--;
+}
+
+/**
+ * Turns checkpoint_latest back into the checkpoint before it by adding the newest delta to
+ * it, and removes the delta from the pool
+ **/
+void checkpoint_pop(void) {
+    uint8_t index = checkpoint_first + checkpoint_deltas - 1;
+    if(index >= CHECKPOINT_MAX_DELTAS) {
+        index -= CHECKPOINT_MAX_DELTAS;
+    }
+    uint8_t length = checkpoint_lengths[index];
+    uint8_t end = checkpoint_pool_end;
+    uint8_t read = end - length;
+
+    uint8_t * data = (uint8_t *)&checkpoint_latest;
+    uint16_t offset = 0;
+    while((read != end) && (offset < sizeof(GameState))) {
+        uint8_t token = checkpoint_pool[read++];
+        if(token < CHECKPOINT_SMALL) {
+            offset += (token & 0x7F) + 1;
+        } else if(token < CHECKPOINT_LITERAL) {
+            // Sign extend the 6 bit delta
+            data[offset++] += (uint8_t)(((token & 0x3F) ^ 0x20) - 0x20);
+        } else {
+            for(uint8_t count = (token & 0x3F) + 1; (count > 0) && (offset < sizeof(GameState)); count--) {
+                data[offset++] += checkpoint_pool[read++];
+            }
+        }
     }
 
-    // STICK_RIGHT
-    b = (PIND>>STICK_RIGHT) & 0x01;
-    controls_history[MOVE_RIGHT] = ((controls_history[MOVE_RIGHT] << 1) & mask) | b;
-    if(controls_history[MOVE_RIGHT] == 0) {
-         controls_states[MOVE_RIGHT] = 0;
-    } else if(controls_history[MOVE_RIGHT] == mask) {
-         controls_states[MOVE_RIGHT] = 1;
+    checkpoint_pool_end = end - length;
+    checkpoint_pool_used -= length;
+    checkpoint_deltas--;
+    checkpoint_latest_time = checkpoint_times[index];
+}
+
+/**
+ * Puts the game and its clock back to the last checkpoint. A checkpoint taken moments ago
+ * would put the player straight back where they were, so the one before it is used instead
+ * (and rewinding again straight away goes back another checkpoint). Returns false if there
+ * is no checkpoint.
+ **/
+bool checkpoint_rewind(void) {
+    if(!checkpoint_valid) {
+        return false;
     }
-    
-    // STICK_UP
-    b = (PIND>>STICK_UP) & 0x01;
-    controls_history[SAVE_GAME] = ((controls_history[SAVE_GAME] << 1) & mask) | b;
-    if(controls_history[SAVE_GAME] == 0) {
-         controls_states[SAVE_GAME] = 0;
-    } else if(controls_history[SAVE_GAME] == mask) {
-         controls_states[SAVE_GAME] = 1;
+    if((checkpoint_counter < CHECKPOINT_INTERVAL / 2) && (checkpoint_deltas > 0)) {
+        checkpoint_pop();
+    }
+
+    game_state_restore(&checkpoint_latest);
+    clock_set(checkpoint_latest_time);
+    splits_restore();
+    checkpoint_counter = 0;
+    return true;
+}
+
+/** ----------------------------------- RANDOM ------------------------------------ **/
+
+/**
+ * Starts every stream from the game's seed. The bytes of the seed are swapped so the low byte
+ * (all there is of a seed from TCNT0) changes the high byte, which the first number comes from.
+ **/
+void random_seed(uint16_t seed) {
+    seed = (seed << 8) | (seed >> 8);
+    for(uint8_t stream = 0; stream < NUM_RANDOM_STREAMS; stream++) {
+        uint16_t key = pgm_read_word(&random_stream_keys[stream]);
+        game.random_state[stream] = ((seed ^ key) != 0) ? (seed ^ key) : key;
+    }
+}
+
+/**
+ * Returns the next number (1-65535) from a stream. The xorshift is the 7, 9, 8 triple, which
+ * goes through every number but 0 and mostly moves whole bytes on the AVR.
+ **/
+static inline uint16_t random_next(uint8_t stream) {
+    uint16_t x = game.random_state[stream];
+    x ^= x << 7;
+    x ^= x >> 9;
+    x ^= x << 8;
+    game.random_state[stream] = x;
+    return x;
+}
+
+/**
+ * Returns a random byte from a stream (the high byte, which is the better mixed one)
+ **/
+static inline uint8_t random_byte(uint8_t stream) {
+    return random_next(stream) >> 8;
+}
+
+/**
+ * Returns a random number from 0 to n-1 (n from 1 to 255) by scaling a random byte, which is
+ * a multiply instead of a division
+ **/
+static inline uint8_t random_below(uint8_t stream, uint8_t n) {
+    return ((uint16_t)random_byte(stream) * n) >> 8;
+}
+
+/**
+ * Returns true with a chance of threshold in 256 (from 0 to 256, so it can be never or always)
+ **/
+static inline bool random_chance(uint8_t stream, uint16_t threshold) {
+    return random_byte(stream) < threshold;
+}
+
+/** ------------------------------------ INPUT ------------------------------------ **/
+/**
+ * Reads every control and debounces them all at once. Called every Timer0 overflow.
+ * A control has to read differently from controls_debounced 6 times in a row before it changes,
+ * a pressed or released event is queued when it does.
+ **/
+static inline void input_sample(void) {
+    // Read the pin of every control into one byte
+    uint8_t sample = 0;
+    for(uint8_t control = 0; control < NUM_CONTROLS; control++) {
+        volatile uint8_t * pin = (volatile uint8_t *)pgm_read_ptr(&control_pins[control].pin);
+        uint8_t bit = pgm_read_byte(&control_pins[control].bit);
+        if(*pin & (1 << bit)) {
+            sample |= 1 << control;
+        }
+    }
+
+    // Count up the controls that disagree with their state and restart the others
+    uint8_t held = controls_debounced;
+    uint8_t changed = sample ^ held;
+    uint8_t count0 = ~debounce_count0 & changed;
+    uint8_t count1 = (debounce_count1 ^ debounce_count0) & changed;
+    uint8_t count2 = (debounce_count2 ^ (debounce_count1 & debounce_count0)) & changed;
+
+    // Flip the controls that reached 6 (0b110) and restart their counters
+    uint8_t toggled = count2 & count1 & ~count0;
+    debounce_count0 = count0 & ~toggled;
+    debounce_count1 = count1 & ~toggled;
+    debounce_count2 = count2 & ~toggled;
+    if(toggled == 0) {
+        return;
+    }
+    held ^= toggled;
+    controls_debounced = held;
+
+    for(uint8_t control = 0; toggled != 0; control++, toggled >>= 1) {
+        if(toggled & 1) {
+            input_push(((held >> control) & 1) ? control : (control | INPUT_RELEASED));
+        }
     }
+}
 
-    // STICK_DOWN
-    b = (PIND>>STICK_DOWN) & 0x01;
-    controls_history[LOAD_GAME] = ((controls_history[LOAD_GAME] << 1) & mask) | b;
-    if(controls_history[LOAD_GAME] == 0) {
-         controls_states[LOAD_GAME] = 0;
-    } else if(controls_history[LOAD_GAME] == mask) {
-         controls_states[LOAD_GAME] = 1;
+/**
+ * Adds an event to the input queue. The event is dropped if the queue is full.
+ * Only called from the Timer0 interrupt.
+ **/
+static inline void input_push(uint8_t event) {
+    uint8_t head = input_queue_head;
+    uint8_t next = (head + 1) & (INPUT_QUEUE_SIZE - 1);
+    if(next != input_queue_tail) {
+        input_queue[head] = event;
+        input_queue_head = next;
     }
 }
 
+/**
+ * Takes all of the events out of the input queue and records the controls that were pressed 
+ * in controls_pressed. Also takes a copy of everything else the interrupts change that the
+ * game logic depends on, so it can't change part way through an update. Called once at the
+ * start of each update().
+ **/
+void input_update(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        controls_held = controls_debounced;
+        update_ticks = frame_ticks;
+        frame_ticks = 0;
+    }
+    pot_speed = adc_value(0);
+
+    controls_pressed = 0;
+
+    uint8_t tail = input_queue_tail;
+    while(tail != input_queue_head) {
+        uint8_t event = input_queue[tail];
+        tail = (tail + 1) & (INPUT_QUEUE_SIZE - 1);
+        // Nothing in the game happens on release yet
+        if(!(event & INPUT_RELEASED)) {
+            controls_pressed |= 1 << event;
+        }
+    }
+    input_queue_tail = tail;
+}
+
+/** ----------------------------------- CLOCK ------------------------------------- **/
+/**
+ * Returns true while the game time is being counted (the game is being played)
+ **/
+static inline bool clock_running(void) {
+    return !game_paused && (game_screen == GAME_SCREEN);
+}
+
+/**
+ * Returns the game time in Timer0 ticks (32us each). The overflow count and TCNT0 are read
+ * together with interrupts off, and an overflow that has happened but hasn't been counted by
+ * the interrupt yet is counted here, so the time can never go backwards.
+ **/
+uint32_t clock_ticks(void) {
+    uint32_t overflows;
+    uint8_t count;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        overflows = game_timer_counter;
+        count = TCNT0;
+        // TCNT0 has wrapped (so it is small) but the interrupt is still waiting to run
+        if((TIFR0 & (1 << TOV0)) && (count < 0x80) && clock_running()) {
+            overflows++;
+        }
+    }
+    return (overflows << 8) | count;
+}
+
+uint32_t clock_ms(void) {
+    return ticks_ms(clock_ticks());
+}
+
+/**
+ * The game time in microseconds, which wraps after about 71 minutes (use clock_ms() for
+ * anything longer)
+ **/
+uint32_t clock_us(void) {
+    return ticks_us(clock_ticks());
+}
+
+/**
+ * Converts Timer0 ticks to milliseconds (ticks * 32 / 1000) without overflowing
+ **/
+uint32_t ticks_ms(uint32_t ticks) {
+    return (ticks / 125) * 4 + ((ticks % 125) * 4) / 125;
+}
+
+uint32_t ticks_us(uint32_t ticks) {
+    return ticks * TIMER0_TICK_US;
+}
+
+/**
+ * Sets the game time to a number of Timer0 overflows (as kept in a save)
+ **/
+void clock_set(uint32_t overflows) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        game_timer_counter = overflows;
+    }
+}
+
+/**
+ * Returns the game time in Timer0 overflows
+ **/
+uint32_t clock_overflows(void) {
+    uint32_t overflows;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        overflows = game_timer_counter;
+    }
+    return overflows;
+}
+
+/**
+ * Returns the distance at which a split of the race ends. The last one is the finish line.
+ **/
+uint8_t split_distance(uint8_t split) {
+    uint16_t length = (uint16_t)game.distance + game.finish_line;
+    return (length * (split + 1)) / NUM_SPLITS;
+}
+
+void splits_reset(void) {
+    memset(split_ticks, 0, sizeof(split_ticks));
+    splits_reached = 0;
+}
+
+/**
+ * Keeps the time of each split the car has just reached. Called whenever the distance goes up.
+ **/
+void splits_update(void) {
+    while((splits_reached < NUM_SPLITS) && (game.distance >= split_distance(splits_reached))) {
+        split_ticks[splits_reached++] = clock_ticks();
+    }
+}
+
+/**
+ * Forgets the splits that are further on than the car after the game has been rewound or
+ * loaded
+ **/
+void splits_restore(void) {
+    splits_reached = 0;
+    while((splits_reached < NUM_SPLITS) && (game.distance >= split_distance(splits_reached))) {
+        splits_reached++;
+    }
+    for(uint8_t split = splits_reached; split < NUM_SPLITS; split++) {
+        split_ticks[split] = 0;
+    }
+}
+
+/**
+ * Returns how long (in Timer0 ticks) a split that has been reached took, from the end of the
+ * one before it
+ **/
+uint32_t lap_ticks(uint8_t split) {
+    return split_ticks[split] - ((split > 0) ? split_ticks[split - 1] : 0);
+}
+
+/** ---------------------------------- TELEMETRY ---------------------------------- **/
+/**
+ * Adds a sample of the game state to the telemetry every TELEMETRY_DIVIDER game steps. 
+ * Called at the end of every game step.
+ **/
+void telemetry_sample(void) {
+    telemetry_step++;
+    if((TELEMETRY_DIVIDER == 0) || (++telemetry_counter < TELEMETRY_DIVIDER)) {
+        return;
+    }
+    telemetry_counter = 0;
+
+    // If both buffers are full the sample is lost
+    TelemetryMessage * message = &telemetry_buffers[telemetry_filling];
+    if((message->count >= TELEMETRY_SAMPLES) && !telemetry_queue()) {
+        if(telemetry_dropped < UINT8_MAX) {
+            telemetry_dropped++;
+        }
+        return;
+    }
+    message = &telemetry_buffers[telemetry_filling];
+
+    TelemetrySample * sample = &message->samples[message->count++];
+    sample->step = telemetry_step;
+    sample->timer = (uint16_t)clock_overflows();
+    sample->speed = (int16_t)(game.speed >> 8);
+    sample->fuel = game.fuel;
+    sample->distance = game.distance;
+    sample->player_x = game.player_x;
+    sample->road_x = road_x(0);
+    sample->condition = game.condition;
+
+    if(message->count >= TELEMETRY_SAMPLES) {
+        telemetry_queue();
+    }
+}
+
+/**
+ * Swaps the buffers so the one being filled starts being sent. Returns false if the other
+ * buffer is still being sent.
+ **/
+bool telemetry_queue(void) {
+    if(telemetry_sending != TELEMETRY_IDLE) {
+        return false;
+    }
+
+    TelemetryMessage * message = &telemetry_buffers[telemetry_filling];
+    message->command = TELEMETRY;
+    message->dropped = telemetry_dropped;
+    telemetry_dropped = 0;
+
+    telemetry_sending = telemetry_filling;
+    telemetry_sent = 0;
+    telemetry_filling ^= 1;
+    telemetry_buffers[telemetry_filling].count = 0;
+    return true;
+}
+
+/**
+ * Sends as much of the queued telemetry as USB will take without waiting. Called between 
+ * frames. A part filled buffer is queued if nothing else is being sent.
+ **/
+void telemetry_drain(void) {
+    if((telemetry_sending == TELEMETRY_IDLE) && (telemetry_buffers[telemetry_filling].count > 0)) {
+        telemetry_queue();
+    }
+    if(telemetry_sending == TELEMETRY_IDLE) {
+        return;
+    }
+
+    const TelemetryMessage * message = &telemetry_buffers[telemetry_sending];
+    const uint8_t * data = (const uint8_t *)message;
+    uint8_t length = TELEMETRY_HEADER_SIZE + message->count * sizeof(TelemetrySample);
+    while(telemetry_sent < length) {
+        if(usb_serial_putchar_nowait(data[telemetry_sent]) < 0) {
+            return;
+        }
+        telemetry_sent++;
+    }
+    telemetry_sending = TELEMETRY_IDLE;
+}
+
+/**
+ * Waits for the telemetry message being sent to finish. Must be called before sending 
+ * anything else to the server so the other message doesn't end up inside it.
+ **/
+void telemetry_finish(void) {
+    if(telemetry_sending == TELEMETRY_IDLE) {
+        return;
+    }
+
+    const TelemetryMessage * message = &telemetry_buffers[telemetry_sending];
+    const uint8_t * data = (const uint8_t *)message;
+    uint8_t length = TELEMETRY_HEADER_SIZE + message->count * sizeof(TelemetrySample);
+    for(; telemetry_sent < length; telemetry_sent++) {
+        usb_serial_putchar(data[telemetry_sent]);
+    }
+    telemetry_sending = TELEMETRY_IDLE;
+}
+
+/** ----------------------------------- REPLAY ------------------------------------ **/
+#if defined(RECORD) || defined(HEADLESS)
+/**
+ * Returns a CRC of the game state. A replay matches the game it was recorded from if they
+ * end with the same checksum. The road queue is filled first, so the checksum doesn't depend
+ * on how far ahead the road had been made.
+ **/
+uint16_t replay_checksum(void) {
+    road_generate();
+
+    const uint8_t * data = (const uint8_t *)&game;
+    uint16_t crc = 0xFFFF;
+    for(uint16_t i = 0; i < sizeof(game); i++) {
+        crc = save_crc_update(crc, data[i]);
+    }
+    return crc;
+}
+#endif
+
+#ifdef RECORD
+/**
+ * Starts recording the game that has just been set up. Called at the end of game_screen_setup().
+ **/
+void replay_start(void) {
+    ReplayStart start = { REPLAY, REPLAY_START, game_seed };
+    replay_recording = true;
+    replay_frames = 0;
+    replay_stop = REPLAY_NONE;
+    replay_input.command = REPLAY;
+    replay_input.kind = REPLAY_INPUT;
+    replay_input.count = 0;
+
+    telemetry_finish();
+    usb_serial_write((uint8_t *)&start, sizeof(start));
+}
+
+/**
+ * Records the inputs input_update() has just taken, sending them once there are REPLAY_FRAMES
+ **/
+void replay_record(void) {
+    if(!replay_recording) {
+        return;
+    }
+
+    ReplayFrame * frame = &replay_input.frames[replay_input.count++];
+    frame->held = controls_held;
+    frame->pressed = controls_pressed;
+    frame->pot = pot_speed;
+    frame->ticks = update_ticks;
+    replay_frames++;
+    if(replay_input.count == REPLAY_FRAMES) {
+        replay_send();
+    }
+}
+
+/**
+ * Sends the frames that have been recorded. This waits for the USB rather than dropping
+ * anything, a replay with frames missing is no use.
+ **/
+void replay_send(void) {
+    if(replay_input.count == 0) {
+        return;
+    }
+    telemetry_finish();
+    usb_serial_write((uint8_t *)&replay_input, REPLAY_INPUT_HEADER_SIZE + replay_input.count * sizeof(ReplayFrame));
+    replay_input.count = 0;
+}
+
+/**
+ * Ends the recording with the checksum of the game state if the game has finished or
+ * replay_stop has been set. Called at the end of each update().
+ **/
+void replay_end(void) {
+    if(!replay_recording) {
+        return;
+    }
+    if(game_screen != GAME_SCREEN) {
+        replay_stop = REPLAY_GAME_OVER;
+    }
+    if(replay_stop == REPLAY_NONE) {
+        return;
+    }
+
+    replay_send();
+    ReplayEnd end = { REPLAY, REPLAY_END, replay_stop, replay_frames, replay_checksum() };
+    usb_serial_write((uint8_t *)&end, sizeof(end));
+    replay_recording = false;
+    replay_stop = REPLAY_NONE;
+}
+#endif
+
+/** ----------------------------------- PROFILE ----------------------------------- **/
+#ifdef PROFILE
+/**
+ * Clears the times recorded so far
+ **/
+void profile_reset(void) {
+    memset(&profile, 0, sizeof(profile));
+    for(uint8_t phase = 0; phase < NUM_PROFILE_PHASES; phase++) {
+        profile.phases[phase].min = UINT16_MAX;
+    }
+}
+
+/**
+ * Adds the time one run of a phase took to its statistics
+ **/
+void profile_record(uint8_t phase, uint16_t us) {
+    ProfileStats * stats = &profile.phases[phase];
+    stats->count++;
+    stats->total += us;
+    if(us < stats->min) {
+        stats->min = us;
+    }
+    if(us > stats->max) {
+        stats->max = us;
+    }
+
+    // Bucket n holds times under 128 << n us
+    uint8_t bucket = 0;
+    for(uint16_t t = us >> PROFILE_BUCKET_SHIFT; (t != 0) && (bucket < PROFILE_BUCKETS - 1); t >>= 1) {
+        bucket++;
+    }
+    stats->histogram[bucket]++;
+}
+
+/**
+ * Records how long the frame took and sends the record to the server every PROFILE_SEND_FRAMES
+ **/
+void profile_frame_end(uint16_t us) {
+    profile_record(PROFILE_FRAME, us);
+    profile.frames++;
+    if(us > PROFILE_FRAME_BUDGET) {
+        profile.overruns++;
+    }
+
+    if(profile.frames >= PROFILE_SEND_FRAMES) {
+        // Take a copy so the ADC interrupt can't change the record while it's being sent
+        ProfileRecord record;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            record = profile;
+            profile_reset();
+        }
+        telemetry_finish();
+        usb_serial_putchar(DEBUG);
+        usb_serial_putchar(PROFILE_MARKER);
+        usb_serial_write((uint8_t *)&record, sizeof(record));
+    }
+}
+#endif
+
+/** ----------------------------------- PHYSICS ----------------------------------- **/
+/**
+ * Changes the speed of the car by the rate given (units per frame) while keeping it between
+ * 0 and the speed limit
+ **/
+void physics_accelerate(fix16_t rate, int speed_limit) {
+    fix16_t new_speed = game.speed + rate;
+
+    if(new_speed > FIX16_FROM_INT(speed_limit)) {
+        new_speed = FIX16_FROM_INT(speed_limit);
+    }else if(new_speed < 0) {
+        new_speed = 0;
+    }
+
+    game.speed = new_speed;
+}
+
+/**
+ * Uses up one unit of fuel
+ **/
+void physics_burn_fuel(void) {
+    game.fuel -= FIX8(1);
+}
+
+/**
+ * Adds one frame worth of fuel to the tank. Returns true if the tank is now full
+ **/
+bool physics_refuel(void) {
+    game.fuel += FUEL_REFUEL_RATE;
+
+    // Prevent overshoot
+    if(game.fuel >= FIX8(FUEL_MAX)) {
+        game.fuel = FIX8(FUEL_MAX);
+        return true;
+    }
+
+    return false;
+}
+
+/** ------------------------------------- ISR ------------------------------------- **/
+/**
+ * Interrupt that processes Timer0 overflow. 
+ * Used for debouncing and elapsed time control
+ **/
+ISR(TIMER0_OVF_vect) {
+    // Increase the overflow counter in order to calculate how much time has elapsed
+    if(clock_running()) {
+        game_timer_counter++;
+    }
+
+    // Debounce the controls
+    input_sample();
+}
+
+/**
+ * Interrupt that processes Timer1 compare matches at loop_freq.
+ * Used for the speed of the game objects (counted in frame_ticks) and starting each frame
+ **/
 ISR(TIMER1_COMPA_vect) {
-	if(!game_paused && (game_screen == GAME_SCREEN)) {
-        double rate = speed/SPEED_FACTOR;
-        speed_counter += rate;
+    if(frame_ticks != UINT8_MAX) {
+        frame_ticks++;
     }
+
+    frame_due = true;
+}
+
+/**
+ * Interrupt that processes the end of an ADC conversion (started by Timer0 overflowing).
+ * Used to filter the pot readings and choose the next channel to convert
+ **/
+ISR(ADC_vect) {
+    PROFILE_START(adc_start);
+    uint8_t channel = adc_channel;
+    adc_filtered[channel] += ADC - (adc_filtered[channel] >> ADC_FILTER_SHIFT);
+
+    // The next channel is converted on the next trigger
+    channel = (channel + 1 < NUM_ADC_CHANNELS) ? channel + 1 : 0;
+    adc_channel = channel;
+    ADMUX = channel | (1 << REFS0);
+    PROFILE_STOP(PROFILE_ADC, adc_start);
 }
\ No newline at end of file
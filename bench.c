@@ -0,0 +1,412 @@
+/***********************************************************************************/
+/* Microbenchmarks of the game logic. Like replay.c, the game is built into this   */
+/* program with HEADLESS defined. On the host the stand-ins in host/ are used and  */
+/* each kernel is timed in nanoseconds. Built with avr-gcc (make bench-avr) the    */
+/* real headers are used, the kernels are timed in CPU cycles with Timer1 and the  */
+/* results are printed on simavr's console.                                        */
+/*                                                                                 */
+/* The game is built with NUM_TERRAIN and NUM_HAZARD from the command line, so     */
+/* make bench builds one of these for every size in BENCH_CONFIGS.                 */
+/*                                                                                 */
+/* Usage: bench_<terrain>_<hazard>.exe [-b baseline]                               */
+/*                                                                                 */
+/* Every result is printed as "<terrain>x<hazard> <kernel> <time> <unit>". Given a */
+/* baseline (a file of earlier results, see make bench-baseline) each result is    */
+/* compared with the one in the baseline, and the program fails if any of them is  */
+/* more than BENCH_REGRESSION percent slower.                                      */
+/***********************************************************************************/
+
+#include "a2_n9424342.c"
+
+#ifdef __AVR__
+// simavr prints what is written to GPIOR0 (see simavr's avr_mcu_section.h)
+#include "avr_mcu_section.h"
+AVR_MCU(F_CPU, "atmega32u4");
+AVR_MCU_SIMAVR_CONSOLE(&GPIOR0);
+#else
+#include <time.h>
+#endif
+
+// The seed of the game every benchmark starts from and the game steps it runs first, so
+// the world is full of terrain and hazards
+#define BENCH_SEED          1
+#define BENCH_WARMUP_STEPS  200
+// A result more than this much slower than the baseline fails the benchmark (percent)
+#define BENCH_REGRESSION    10
+#define BENCH_MAX_BASELINE  64
+
+#ifdef __AVR__
+// Each kernel is run this many times and the average is reported
+#define BENCH_ITERATIONS    100
+// The CPU cycles in one frame, for comparing each kernel with the frame budget
+#define BENCH_FRAME_CYCLES  (F_CPU / 60)
+#else
+// Each kernel is run in batches of at least this long, the fastest of BENCH_REPEATS is reported
+#define BENCH_MIN_NS        50000000.0
+#define BENCH_REPEATS       5
+#endif
+
+typedef struct Benchmark {
+    const char * name;
+    void (*run)(uint16_t i);
+    void (*prepare)(uint16_t i);    // If there is one, it is run before each run but not timed
+} Benchmark;
+
+typedef struct BenchResult {
+    char config[16];
+    char kernel[32];
+    double time;
+    char unit[16];
+} BenchResult;
+
+void bench_setup(void);
+void bench_road_step(uint16_t i);
+void bench_check_collision(uint16_t i);
+void bench_terrain_reset(uint16_t i);
+void bench_hazard_reset(uint16_t i);
+void bench_player_car_move(uint16_t i);
+bool bench_old_in_bounds(double x, double y);
+void bench_in_bounds(uint16_t i);
+void bench_in_bounds_double(uint16_t i);
+void bench_game_screen_step(uint16_t i);
+void bench_road_generate(uint16_t i);
+void bench_game_screen_draw(uint16_t i);
+void bench_calibrate(void);
+double bench_measure(const Benchmark * benchmark);
+int bench_load_baseline(const char * file_name, BenchResult * baseline, int max);
+
+const Benchmark benchmarks[] = {
+    { "road_step", bench_road_step, NULL },
+    { "check_collision", bench_check_collision, NULL },
+    { "terrain_reset", bench_terrain_reset, NULL },
+    { "hazard_reset", bench_hazard_reset, NULL },
+    { "player_car_move", bench_player_car_move, NULL },
+    { "in_bounds", bench_in_bounds, NULL },
+    { "in_bounds_double", bench_in_bounds_double, NULL },
+    { "game_screen_step", bench_game_screen_step, bench_road_generate },
+    { "game_screen_draw", bench_game_screen_draw, NULL },
+};
+#define NUM_BENCHMARKS      (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+volatile uint8_t bench_sink;        // Results go here so the compiler can't leave the kernels out
+
+#ifdef __AVR__
+volatile uint16_t bench_cycles_high;    // Timer1 overflows, the top half of the cycle count
+uint32_t bench_overhead;                // The cycles taken by reading the time around a kernel
+#else
+double bench_overhead;                  // The nanoseconds taken by reading the time around a kernel
+#endif
+
+//-------------------------------------------------------------------
+
+#ifdef __AVR__
+/**
+ * Sends a character to simavr's console
+ **/
+int bench_putchar(char c, FILE * stream) {
+    (void)stream;
+    GPIOR0 = c;
+    return 0;
+}
+
+FILE bench_output = FDEV_SETUP_STREAM(bench_putchar, NULL, _FDEV_SETUP_WRITE);
+
+ISR(TIMER1_OVF_vect) {
+    bench_cycles_high++;
+}
+
+/**
+ * Returns the CPU cycles since Timer1 was started
+ **/
+uint32_t bench_cycles(void) {
+    uint16_t low, high;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        low = TCNT1;
+        high = bench_cycles_high;
+        // An overflow that hasn't been handled yet
+        if((TIFR1 & (1 << TOV1)) && (low < 0x8000)) {
+            high++;
+        }
+    }
+    return ((uint32_t)high << 16) | low;
+}
+
+int main(void) {
+    stdout = &bench_output;
+    // Timer1 counts every CPU cycle
+    TCCR1A = 0;
+    TCCR1B = 1 << CS10;
+    TIMSK1 = 1 << TOIE1;
+    sei();
+    bench_calibrate();
+
+    for(uint8_t b = 0; b < NUM_BENCHMARKS; b++) {
+        uint32_t cycles = (uint32_t)bench_measure(&benchmarks[b]);
+        // In hundredths of a percent, done in 64 bits as cycles * 10000 overflows past 429k cycles
+        uint32_t share = (uint32_t)(((uint64_t)cycles * 10000) / BENCH_FRAME_CYCLES);
+        printf("%dx%d %s %lu cycles (%lu.%02lu%% of a frame)\n", NUM_TERRAIN, NUM_HAZARD, benchmarks[b].name,
+            (unsigned long)cycles, (unsigned long)(share / 100), (unsigned long)(share % 100));
+    }
+
+    // Stop the simulation
+    cli();
+    sleep_cpu();
+    return 0;
+}
+#else
+int main(int argc, char *argv[]) {
+    BenchResult baseline[BENCH_MAX_BASELINE];
+    int num_baseline = 0;
+    if((argc == 3) && (strcmp(argv[1], "-b") == 0)) {
+        num_baseline = bench_load_baseline(argv[2], baseline, BENCH_MAX_BASELINE);
+        if(num_baseline < 0) {
+            fprintf(stderr, "Unable to read the baseline %s\n", argv[2]);
+            return 1;
+        }
+    } else if(argc != 1) {
+        fprintf(stderr, "Usage: %s [-b baseline]\n", argv[0]);
+        return 1;
+    }
+
+    bench_calibrate();
+    char config[16];
+    snprintf(config, sizeof(config), "%dx%d", NUM_TERRAIN, NUM_HAZARD);
+    bool regressed = false;
+    for(size_t b = 0; b < NUM_BENCHMARKS; b++) {
+        double ns = bench_measure(&benchmarks[b]);
+        printf("%-8s %-20s %10.1f ns", config, benchmarks[b].name, ns);
+
+        for(int i = 0; i < num_baseline; i++) {
+            if((strcmp(baseline[i].config, config) == 0) && (strcmp(baseline[i].kernel, benchmarks[b].name) == 0) &&
+                    (strcmp(baseline[i].unit, "ns") == 0) && (baseline[i].time > 0)) {
+                double change = (ns - baseline[i].time) * 100.0 / baseline[i].time;
+                printf("   %+6.1f%% vs %.1f%s", change, baseline[i].time, (change > BENCH_REGRESSION) ? "  SLOWER" : "");
+                regressed |= (change > BENCH_REGRESSION);
+                break;
+            }
+        }
+        printf("\n");
+    }
+    return regressed ? 1 : 0;
+}
+
+/**
+ * Reads the results in a baseline file. Returns the number read or -1 if the file can't
+ * be opened.
+ **/
+int bench_load_baseline(const char * file_name, BenchResult * baseline, int max) {
+    FILE * file = fopen(file_name, "r");
+    if(file == NULL) {
+        return -1;
+    }
+    int count = 0;
+    char line[128];
+    while((count < max) && (fgets(line, sizeof(line), file) != NULL)) {
+        BenchResult * result = &baseline[count];
+        if(sscanf(line, "%15s %31s %lf %15s", result->config, result->kernel, &result->time, result->unit) == 4) {
+            count++;
+        }
+    }
+    fclose(file);
+    return count;
+}
+#endif
+
+//-------------------------------------------------------------------
+
+/**
+ * Starts the same game for every benchmark and runs it for BENCH_WARMUP_STEPS steps
+ **/
+void bench_setup(void) {
+    controls_debounced = 0;
+    controls_held = 0;
+    controls_pressed = 0;
+    input_queue_head = input_queue_tail = 0;
+    frame_ticks = 0;
+    load_state = LOAD_IDLE;
+
+    TCNT0 = BENCH_SEED;
+    // This also clears TCNT1, which the AVR build counts cycles with, so the timing starts after it
+    change_screen(GAME_SCREEN);
+    for(uint16_t i = 0; i < BENCH_WARMUP_STEPS; i++) {
+        bench_game_screen_step(i);
+        bench_road_generate(i);
+    }
+}
+
+void bench_road_step(uint16_t i) {
+    (void)i;
+    road_step();
+}
+
+void bench_check_collision(uint16_t i) {
+    (void)i;
+    bench_sink += check_collision(game.player_x, PLAYER_Y, &player_sprite);
+}
+
+/**
+ * Respawns each terrain in turn at the top of the screen, as terrain_step() does
+ **/
+void bench_terrain_reset(uint16_t i) {
+    terrain_reset(FIRST_TERRAIN + i % NUM_TERRAIN, 0);
+}
+
+void bench_hazard_reset(uint16_t i) {
+    hazard_reset(FIRST_HAZARD + i % NUM_HAZARD, 0);
+}
+
+/**
+ * Steers the car one pixel left and then back right, as update() does while a control is held
+ **/
+void bench_player_car_move(uint16_t i) {
+    player_car_move((i & 1) ? 1 : -1);
+}
+
+/**
+ * The in_bounds() the game had before it took ints, kept here so one run of the benchmarks
+ * compares the two (a double is a 32 bit soft float on the AVR)
+ **/
+bool bench_old_in_bounds(double x, double y) {
+    if((x <= DASHBOARD_BORDER_X) || (x > LCD_X-1)) {
+        return false;
+    } else if((y <= 1) || (y > LCD_Y-1)) {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * The two checks player_car_move() makes, with the car's x at each side of the dashboard
+ * border in turn
+ **/
+void bench_in_bounds(uint16_t i) {
+    int x = DASHBOARD_BORDER_X + (i & 1);
+    bench_sink += in_bounds(x, PLAYER_Y) && in_bounds(x + CAR_WIDTH, PLAYER_Y);
+}
+
+void bench_in_bounds_double(uint16_t i) {
+    int x = DASHBOARD_BORDER_X + (i & 1);
+    bench_sink += bench_old_in_bounds(x, PLAYER_Y) && bench_old_in_bounds(x + CAR_WIDTH, PLAYER_Y);
+}
+
+/**
+ * One game step, with the car kept alive (and full of fuel) so the game never ends
+ **/
+void bench_game_screen_step(uint16_t i) {
+    (void)i;
+    game.fuel = FIX8(FUEL_MAX);
+    game.condition = 100;
+    game.finish_line = LEVEL_FINISH_LINE;
+    game_screen = GAME_SCREEN;
+    game_screen_step();
+}
+
+/**
+ * Makes the road ahead, as main() does after every update(), so each game step finds the
+ * road queue as full as it is on the Teensy
+ **/
+void bench_road_generate(uint16_t i) {
+    (void)i;
+    road_generate();
+}
+
+/**
+ * Draws the game into a cleared playfield, as draw() does every frame
+ **/
+void bench_game_screen_draw(uint16_t i) {
+    (void)i;
+    clear_playfield();
+    game_screen_draw();
+    bench_sink += screen_buffer[LCD_X + DASHBOARD_BORDER_X + 1];
+}
+
+#ifndef __AVR__
+/**
+ * Returns the nanoseconds on the monotonic clock
+ **/
+double bench_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+#endif
+
+/**
+ * Measures how long it takes to read the time, which is taken off each run of a kernel
+ * with a prepare step, as those are timed one run at a time
+ **/
+void bench_calibrate(void) {
+#ifdef __AVR__
+    uint32_t start = bench_cycles();
+    bench_overhead = bench_cycles() - start;
+#else
+    for(int i = 0; i < 1000; i++) {
+        double start = bench_ns();
+        double time = bench_ns() - start;
+        if((i == 0) || (time < bench_overhead)) {
+            bench_overhead = time;
+        }
+    }
+#endif
+}
+
+/**
+ * Returns the average time one run of a kernel takes, in CPU cycles on the AVR and in
+ * nanoseconds on the host. The prepare step of a kernel isn't counted.
+ **/
+double bench_measure(const Benchmark * benchmark) {
+#ifdef __AVR__
+    bench_setup();
+    uint32_t cycles = 0;
+    if(benchmark->prepare == NULL) {
+        uint32_t start = bench_cycles();
+        for(uint16_t i = 0; i < BENCH_ITERATIONS; i++) {
+            benchmark->run(i);
+        }
+        cycles = bench_cycles() - start;
+    } else {
+        for(uint16_t i = 0; i < BENCH_ITERATIONS; i++) {
+            benchmark->prepare(i);
+            uint32_t start = bench_cycles();
+            benchmark->run(i);
+            cycles += bench_cycles() - start - bench_overhead;
+        }
+    }
+    return (double)(cycles / BENCH_ITERATIONS);
+#else
+    double best = 0;
+    uint32_t iterations = 1;
+    for(int repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+        double ns;
+        for(;;) {
+            bench_setup();
+            if(benchmark->prepare == NULL) {
+                double start = bench_ns();
+                for(uint32_t i = 0; i < iterations; i++) {
+                    benchmark->run((uint16_t)i);
+                }
+                ns = bench_ns() - start;
+            } else {
+                ns = 0;
+                for(uint32_t i = 0; i < iterations; i++) {
+                    benchmark->prepare((uint16_t)i);
+                    double start = bench_ns();
+                    benchmark->run((uint16_t)i);
+                    ns += bench_ns() - start - bench_overhead;
+                }
+            }
+            if(ns >= BENCH_MIN_NS) {
+                break;
+            }
+            // Not long enough to time reliably, try again with enough iterations
+            iterations = (ns > 0) ? (uint32_t)(iterations * BENCH_MIN_NS * 1.2 / ns) + 1 : iterations * 10;
+        }
+        ns /= iterations;
+        if((repeat == 0) || (ns < best)) {
+            best = ns;
+        }
+    }
+    return best;
+#endif
+}
@@ -0,0 +1,12 @@
+/*
+ * Host stand-ins for the headless build of the game (see replay.c). Interrupt handlers
+ * become ordinary functions that are never called unless the host calls them.
+ */
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#define ISR(vector)     void vector(void)
+#define sei()
+#define cli()
+
+#endif
@@ -0,0 +1,47 @@
+/*
+ * Host stand-ins for the headless build of the game (see replay.c). The registers are
+ * plain variables so the game can read and write them, nothing happens when it does.
+ */
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+static volatile uint8_t TCCR0A, TCCR0B, TCNT0, TIMSK0, TIFR0;
+static volatile uint8_t TCCR1A, TCCR1B, TIMSK1;
+static volatile uint16_t TCNT1, OCR1A;
+static volatile uint8_t TCCR3A, TCCR3B;
+static volatile uint16_t TCNT3;
+static volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+static volatile uint16_t ADC;
+static volatile uint8_t DDRB, DDRD, DDRF, PORTB, PORTD, PORTF, PINB, PIND, PINF;
+static volatile uint8_t SREG, SMCR;
+
+#define CS00    0
+#define CS01    1
+#define CS02    2
+#define TOIE0   0
+#define TOV0    0
+#define CS10    0
+#define CS11    1
+#define CS12    2
+#define WGM12   3
+#define OCIE1A  1
+#define CS30    0
+#define CS31    1
+#define CS32    2
+#define ADPS0   0
+#define ADPS1   1
+#define ADPS2   2
+#define ADIE    3
+#define ADIF    4
+#define ADATE   5
+#define ADSC    6
+#define ADEN    7
+#define ADTS0   0
+#define ADTS1   1
+#define ADTS2   2
+#define REFS0   6
+#define REFS1   7
+
+#endif
@@ -0,0 +1,22 @@
+/*
+ * Host stand-ins for the headless build of the game (see replay.c). There is only one
+ * address space on the host, so flash reads are ordinary reads.
+ */
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#define PROGMEM
+#define PSTR(s)             (s)
+#define pgm_read_byte(p)    (*(const uint8_t *)(p))
+#define pgm_read_word(p)    (*(const uint16_t *)(p))
+#define pgm_read_dword(p)   (*(const uint32_t *)(p))
+#define pgm_read_ptr(p)     (*(void * const *)(p))
+#define memcpy_P            memcpy
+#define strcpy_P            strcpy
+#define strlen_P            strlen
+
+#endif
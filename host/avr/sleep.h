@@ -0,0 +1,13 @@
+/*
+ * Host stand-ins for the headless build of the game (see replay.c)
+ */
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+#define SLEEP_MODE_IDLE     0
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()
+
+#endif
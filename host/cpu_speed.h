@@ -0,0 +1,10 @@
+/*
+ * Host stand-ins for the headless build of the game (see replay.c)
+ */
+#ifndef HOST_CPU_SPEED_H
+#define HOST_CPU_SPEED_H
+
+#define CPU_8MHz    0x01
+#define set_clock_speed(speed)
+
+#endif
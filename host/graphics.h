@@ -0,0 +1,59 @@
+/*
+ * Host stand-ins for the headless build of the game (see replay.c). Pixels are drawn into
+ * screen_buffer as on the Teensy, text isn't drawn at all.
+ */
+#ifndef HOST_GRAPHICS_H
+#define HOST_GRAPHICS_H
+
+#include <stdint.h>
+#include <string.h>
+#include "lcd.h"
+
+#define LCD_BUFFER_SIZE     (LCD_X * (LCD_Y / 8))
+#define CHAR_WIDTH          5
+#define CHAR_HEIGHT         8
+
+typedef enum colour {
+    BG_COLOUR = 0,
+    FG_COLOUR = 1
+} colour_t;
+
+static uint8_t screen_buffer[LCD_BUFFER_SIZE];
+
+static inline void clear_screen(void) {
+    memset(screen_buffer, 0, sizeof(screen_buffer));
+}
+
+static inline void show_screen(void) {}
+
+static inline void draw_pixel(int x, int y, colour_t colour) {
+    if((x < 0) || (x >= LCD_X) || (y < 0) || (y >= LCD_Y)) {
+        return;
+    }
+    if(colour == FG_COLOUR) {
+        screen_buffer[(y >> 3) * LCD_X + x] |= (1 << (y & 7));
+    } else {
+        screen_buffer[(y >> 3) * LCD_X + x] &= ~(1 << (y & 7));
+    }
+}
+
+static inline void draw_line(int x1, int y1, int x2, int y2, colour_t colour) {
+    int dx = (x2 > x1) ? x2 - x1 : x1 - x2;
+    int dy = (y2 > y1) ? y2 - y1 : y1 - y2;
+    int steps = (dx > dy) ? dx : dy;
+    for(int i = 0; i <= steps; i++) {
+        int x = (steps == 0) ? x1 : x1 + (x2 - x1) * i / steps;
+        int y = (steps == 0) ? y1 : y1 + (y2 - y1) * i / steps;
+        draw_pixel(x, y, colour);
+    }
+}
+
+static inline void draw_char(int x, int y, char character, colour_t colour) {
+    (void)x; (void)y; (void)character; (void)colour;
+}
+
+static inline void draw_string(int x, int y, char * text, colour_t colour) {
+    (void)x; (void)y; (void)text; (void)colour;
+}
+
+#endif
@@ -0,0 +1,21 @@
+/*
+ * Host stand-ins for the headless build of the game (see replay.c). There is no LCD, so
+ * everything sent to it is thrown away.
+ */
+#ifndef HOST_LCD_H
+#define HOST_LCD_H
+
+#include <stdint.h>
+
+#define LCD_X                   84
+#define LCD_Y                   48
+#define LCD_C                   0
+#define LCD_D                   1
+#define LCD_DEFAULT_CONTRAST    0x3F
+
+static inline void lcd_init(uint8_t contrast) { (void)contrast; }
+static inline void lcd_write(uint8_t dc, uint8_t data) { (void)dc; (void)data; }
+static inline void lcd_position(uint8_t x, uint8_t y) { (void)x; (void)y; }
+static inline void lcd_clear(void) {}
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ * Host stand-ins for the headless build of the game (see replay.c), the PCD8544 commands
+ * from cab202_teensy's lcd_model.h
+ */
+#ifndef HOST_LCD_MODEL_H
+#define HOST_LCD_MODEL_H
+
+#include "lcd.h"
+
+#define LCD_CMD(cmd, arg)   lcd_write(LCD_C, (cmd) | (arg))
+#define LCD_DATA(data)      lcd_write(LCD_D, (data))
+
+enum {
+    lcd_set_function = 0x20,
+    lcd_set_display_mode = 0x08,
+    lcd_set_y_addr = 0x40,
+    lcd_set_x_addr = 0x80,
+    lcd_set_contrast = 0x80,
+    lcd_instr_basic = 0x00,
+    lcd_instr_extended = 0x01
+};
+
+#endif
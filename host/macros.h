@@ -0,0 +1,14 @@
+/*
+ * Host stand-ins for the headless build of the game (see replay.c), the same macros as
+ * cab202_teensy's macros.h
+ */
+#ifndef HOST_MACROS_H
+#define HOST_MACROS_H
+
+#define SET_BIT(reg, pin)       (reg) |= (1 << (pin))
+#define CLEAR_BIT(reg, pin)     (reg) &= ~(1 << (pin))
+#define WRITE_BIT(reg, pin, value) (reg) = (((reg) & ~(1 << (pin))) | ((value) << (pin)))
+#define BIT_VALUE(reg, pin)     (((reg) >> (pin)) & 1)
+#define BIT_IS_SET(reg, pin)    (BIT_VALUE((reg),(pin))==1)
+
+#endif
@@ -0,0 +1,30 @@
+/*
+ * Host stand-ins for the headless build of the game (see replay.c), the same Sprite as
+ * cab202_teensy's sprite.h. The game draws its sprites itself.
+ */
+#ifndef HOST_SPRITE_H
+#define HOST_SPRITE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct sprite {
+    float x, y;
+    unsigned char width, height;
+    float dx, dy;
+    bool is_visible;
+    uint8_t * bitmap;
+} Sprite;
+
+static inline void sprite_init(Sprite * sprite, float x, float y, unsigned char width, unsigned char height, uint8_t * bitmap) {
+    sprite->x = x;
+    sprite->y = y;
+    sprite->width = width;
+    sprite->height = height;
+    sprite->dx = 0;
+    sprite->dy = 0;
+    sprite->is_visible = true;
+    sprite->bitmap = bitmap;
+}
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ * Host stand-ins for the headless build of the game (see replay.c). Nothing is connected,
+ * so anything sent is thrown away and nothing is ever received. A RECORD build hands what
+ * it writes to host_serial_write(), which the program it is built into provides (see
+ * replay_test.c).
+ */
+#ifndef HOST_USB_SERIAL_H
+#define HOST_USB_SERIAL_H
+
+#include <stdint.h>
+
+static inline void usb_init(void) {}
+static inline uint8_t usb_configured(void) { return 1; }
+static inline int16_t usb_serial_getchar(void) { return -1; }
+static inline uint8_t usb_serial_available(void) { return 0; }
+static inline void usb_serial_flush_input(void) {}
+static inline int8_t usb_serial_putchar(uint8_t c) { (void)c; return 0; }
+static inline int8_t usb_serial_putchar_nowait(uint8_t c) { (void)c; return 0; }
+#ifdef RECORD
+int8_t host_serial_write(const uint8_t * buffer, uint16_t size);
+static inline int8_t usb_serial_write(const uint8_t * buffer, uint16_t size) { return host_serial_write(buffer, size); }
+#else
+static inline int8_t usb_serial_write(const uint8_t * buffer, uint16_t size) { (void)buffer; (void)size; return 0; }
+#endif
+static inline void usb_serial_flush_output(void) {}
+
+#endif
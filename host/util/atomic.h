@@ -0,0 +1,12 @@
+/*
+ * Host stand-ins for the headless build of the game (see replay.c). Nothing interrupts
+ * the game on the host, so an atomic block only has to run its body once.
+ */
+#ifndef HOST_UTIL_ATOMIC_H
+#define HOST_UTIL_ATOMIC_H
+
+#define ATOMIC_BLOCK(type)  for(int atomic_once = 1; atomic_once; atomic_once = 0)
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+
+#endif
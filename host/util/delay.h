@@ -0,0 +1,10 @@
+/*
+ * Host stand-ins for the headless build of the game (see replay.c). Delays are skipped.
+ */
+#ifndef HOST_UTIL_DELAY_H
+#define HOST_UTIL_DELAY_H
+
+#define _delay_ms(ms)
+#define _delay_us(us)
+
+#endif
@@ -0,0 +1,346 @@
+/***********************************************************************************/
+/* Turns the level descriptions in levels.txt into levels.h, which the game is     */
+/* built with (the makefile runs this whenever levels.txt changes). Everything     */
+/* the game would otherwise work out at runtime is worked out here: rates become   */
+/* Q16.16 constants, chances become thresholds out of 256 and every random range   */
+/* is given as its minimum and size. levels.h has the numbers of every level and   */
+/* uses the one LEVEL was defined as when the game is built (the first otherwise). */
+/*                                                                                 */
+/* Usage: levelgen.exe levels.txt > levels.h                                       */
+/***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+#define MAX_LEVELS          16
+#define MAX_NAME_LENGTH     16
+#define MAX_LINE_LENGTH     200
+// The most a rate can change the speed by in one update(), so the speed plus a rate always
+// fits in the game's Q16.16 (the same as the largest speed_max)
+#define MAX_RATE            100
+
+enum SettingKind {
+    SETTING_INT,            // A whole number from min to max
+    SETTING_RATE            // A change in speed each update(), written as speed/updates
+};
+
+typedef struct Setting {
+    const char * name;
+    enum SettingKind kind;
+    long min;
+    long max;
+} Setting;
+
+// Everything a level has to set. The speed rates are also written out as one table, in the
+// order of enum SpeedMode in the game and on the road before off it. The min and max keep
+// each setting in the type the game keeps it in.
+const Setting settings[] = {
+    { "finish_line", SETTING_INT, 1, 255 },
+    { "road_width", SETTING_INT, 8, 40 },
+    { "road_curve_min", SETTING_INT, 1, 100 },
+    { "road_curve_max", SETTING_INT, 1, 100 },
+    { "road_section_min", SETTING_INT, 1, 255 },
+    { "road_section_max", SETTING_INT, 1, 255 },
+    { "speed_max", SETTING_INT, 1, 100 },
+    { "speed_offroad_max", SETTING_INT, 1, 100 },
+    { "brake", SETTING_RATE, 0, 0 },
+    { "brake_offroad", SETTING_RATE, 0, 0 },
+    { "accel", SETTING_RATE, 0, 0 },
+    { "accel_offroad", SETTING_RATE, 0, 0 },
+    { "coast", SETTING_RATE, 0, 0 },
+    { "coast_offroad", SETTING_RATE, 0, 0 },
+    { "creep", SETTING_RATE, 0, 0 },
+    { "creep_offroad", SETTING_RATE, 0, 0 },
+    { "fuel_factor", SETTING_INT, 0, 255 },
+    { "fuel_station_min", SETTING_INT, 20, 1000 },
+    { "fuel_station_max", SETTING_INT, 20, 1000 },
+    { "hazard_spawn_chance", SETTING_INT, 0, 100 },
+};
+#define NUM_SETTINGS        (sizeof(settings) / sizeof(settings[0]))
+
+typedef struct Level {
+    char name[MAX_NAME_LENGTH];
+    bool set[NUM_SETTINGS];
+    long values[NUM_SETTINGS];      // The whole number, or the Q16.16 rate
+    char rates[NUM_SETTINGS][64];   // How each rate was written, for the comments
+} Level;
+
+Level levels[MAX_LEVELS];
+int num_levels;
+
+const char * file_name;
+int line_number;
+
+void fail(const char * message, const char * detail);
+int setting_find(const char * name);
+long level_value(const Level * level, const char * name);
+long level_range(const Level * level, const char * min, const char * max);
+long level_threshold(const Level * level, const char * chance);
+void level_check_fits(const Level * level, const char * name, long value, long min, long max);
+void level_check(const Level * level);
+void levels_read(FILE * file);
+void levels_write(void);
+
+//-------------------------------------------------------------------
+
+int main(int argc, char *argv[]) {
+    if(argc != 2) {
+        fprintf(stderr, "Usage: %s levels.txt > levels.h\n", argv[0]);
+        return 1;
+    }
+
+    file_name = argv[1];
+    FILE * file = fopen(file_name, "r");
+    if(file == NULL) {
+        fprintf(stderr, "%s: unable to open\n", file_name);
+        return 1;
+    }
+    levels_read(file);
+    fclose(file);
+
+    levels_write();
+    return 0;
+}
+
+/**
+ * Stops with an error about the line being read (or the whole file once line_number is 0)
+ **/
+void fail(const char * message, const char * detail) {
+    if(line_number > 0) {
+        fprintf(stderr, "%s:%d: %s%s\n", file_name, line_number, message, detail);
+    } else {
+        fprintf(stderr, "%s: %s%s\n", file_name, message, detail);
+    }
+    exit(1);
+}
+
+/**
+ * Returns the index of a setting in settings[] or -1 if there is no such setting
+ **/
+int setting_find(const char * name) {
+    for(int i = 0; i < (int)NUM_SETTINGS; i++) {
+        if(strcmp(settings[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+long level_value(const Level * level, const char * name) {
+    return level->values[setting_find(name)];
+}
+
+/**
+ * Returns how many numbers there are from one setting to another, for random_below()
+ **/
+long level_range(const Level * level, const char * min, const char * max) {
+    return level_value(level, max) + 1 - level_value(level, min);
+}
+
+/**
+ * Returns a chance in percent as a threshold out of 256, for random_chance()
+ **/
+long level_threshold(const Level * level, const char * chance) {
+    return level_value(level, chance) * 256 / 100;
+}
+
+/**
+ * Stops with an error if a number worked out for the level doesn't fit where the game
+ * keeps it
+ **/
+void level_check_fits(const Level * level, const char * name, long value, long min, long max) {
+    if((value < min) || (value > max)) {
+        fprintf(stderr, "%s: level %s has %s of %ld, which has to be from %ld to %ld\n", file_name,
+            level->name, name, value, min, max);
+        exit(1);
+    }
+}
+
+/**
+ * Checks that a level has every setting, that the ranges make sense and that everything
+ * written to levels.h for it fits in the types the game uses
+ **/
+void level_check(const Level * level) {
+    for(int i = 0; i < (int)NUM_SETTINGS; i++) {
+        if(!level->set[i]) {
+            fprintf(stderr, "%s: level %s doesn't set %s\n", file_name, level->name, settings[i].name);
+            exit(1);
+        }
+    }
+
+    static const char * ranges[][2] = {
+        { "road_curve_min", "road_curve_max" },
+        { "road_section_min", "road_section_max" },
+        { "speed_offroad_max", "speed_max" },
+        { "fuel_station_min", "fuel_station_max" },
+    };
+    for(int i = 0; i < (int)(sizeof(ranges) / sizeof(ranges[0])); i++) {
+        long min = level_value(level, ranges[i][0]);
+        long max = level_value(level, ranges[i][1]);
+        if(min > max) {
+            fprintf(stderr, "%s: level %s has %s above %s\n", file_name, level->name, ranges[i][0], ranges[i][1]);
+            exit(1);
+        }
+        // The game picks from a range with random_below(), which takes up to 255
+        if(max + 1 - min > 255) {
+            fprintf(stderr, "%s: level %s has more than 255 from %s to %s\n", file_name, level->name,
+                ranges[i][0], ranges[i][1]);
+            exit(1);
+        }
+    }
+
+    // The rest of what levels_write() works out. random_chance() takes a threshold up to 256
+    // (always), a fuel station counter is an int16_t from the minimum plus up to the range less
+    // one, and the rates are added to the Q16.16 speed.
+    level_check_fits(level, "LEVEL_HAZARD_SPAWN_THRESHOLD", level_threshold(level, "hazard_spawn_chance"), 0, 256);
+    level_check_fits(level, "the longest fuel station counter",
+        level_value(level, "fuel_station_min") + level_range(level, "fuel_station_min", "fuel_station_max") - 1,
+        0, INT16_MAX);
+    for(int s = setting_find("brake"); s <= setting_find("creep_offroad"); s++) {
+        level_check_fits(level, settings[s].name, level->values[s], -(long)MAX_RATE << 16, (long)MAX_RATE << 16);
+    }
+}
+
+/**
+ * Reads every level in the file. Each line is a "level <name>" that starts a new level, a
+ * "<setting> <value>" for the current level, or blank. Anything after a # is a comment.
+ **/
+void levels_read(FILE * file) {
+    char line[MAX_LINE_LENGTH];
+    Level * level = NULL;
+
+    line_number = 0;
+    while(fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char * comment = strchr(line, '#');
+        if(comment != NULL) {
+            *comment = '\0';
+        }
+
+        char key[64], value[64], extra[2];
+        int fields = sscanf(line, "%63s %63s %1s", key, value, extra);
+        if(fields <= 0) {
+            continue;
+        } else if(fields != 2) {
+            fail("expected a name and a value", "");
+        }
+
+        if(strcmp(key, "level") == 0) {
+            if(num_levels == MAX_LEVELS) {
+                fail("too many levels", "");
+            }
+            if(strlen(value) >= MAX_NAME_LENGTH) {
+                fail("level name too long: ", value);
+            }
+            for(char * c = value; *c != '\0'; c++) {
+                if(!isalnum((unsigned char)*c) && (*c != '_')) {
+                    fail("a level name can only have letters, digits and underscores: ", value);
+                }
+            }
+            for(int i = 0; i < num_levels; i++) {
+                if(strcasecmp(levels[i].name, value) == 0) {
+                    fail("level defined twice: ", value);
+                }
+            }
+            level = &levels[num_levels++];
+            memset(level, 0, sizeof(Level));
+            strcpy(level->name, value);
+            continue;
+        }
+
+        if(level == NULL) {
+            fail("expected a level before its settings", "");
+        }
+        int index = setting_find(key);
+        if(index < 0) {
+            fail("unknown setting: ", key);
+        }
+        const Setting * setting = &settings[index];
+
+        char * end;
+        if(setting->kind == SETTING_INT) {
+            long number = strtol(value, &end, 10);
+            if((*end != '\0') || (number < setting->min) || (number > setting->max)) {
+                fail("value out of range for ", key);
+            }
+            level->values[index] = number;
+        } else {
+            // speed/updates, the same rounding as FIX16() in the game
+            double speed = strtod(value, &end);
+            double updates = 0;
+            if(*end == '/') {
+                updates = strtod(end + 1, &end);
+            }
+            if((*end != '\0') || (updates <= 0)) {
+                fail("expected a rate as speed/updates for ", key);
+            }
+            double rate = speed / updates;
+            if(!(fabs(rate) <= MAX_RATE)) {
+                fail("rate out of range for ", key);
+            }
+            level->values[index] = (long)(rate * 65536.0 + (rate < 0 ? -0.5 : 0.5));
+            snprintf(level->rates[index], sizeof(level->rates[index]), "%s", value);
+        }
+        level->set[index] = true;
+    }
+
+    line_number = 0;
+    if(num_levels == 0) {
+        fail("no levels", "");
+    }
+    for(int i = 0; i < num_levels; i++) {
+        level_check(&levels[i]);
+    }
+}
+
+/**
+ * Writes levels.h to stdout
+ **/
+void levels_write(void) {
+    printf("/* Generated by levelgen.exe from %s, edit that instead */\n", file_name);
+    printf("#ifndef LEVELS_H\n#define LEVELS_H\n\n");
+    printf("#define NUM_LEVELS %d\n", num_levels);
+    for(int i = 0; i < num_levels; i++) {
+        printf("#define LEVEL_");
+        for(const char * c = levels[i].name; *c != '\0'; c++) {
+            putchar(toupper((unsigned char)*c));
+        }
+        printf(" %d\n", i);
+    }
+    printf("\n#ifndef LEVEL\n#define LEVEL 0\n#endif\n");
+
+    for(int i = 0; i < num_levels; i++) {
+        const Level * level = &levels[i];
+        printf("\n#%s LEVEL == %d\n", (i == 0) ? "if" : "elif", i);
+        printf("#define LEVEL_NAME \"%s\"\n", level->name);
+        for(int s = 0; s < (int)NUM_SETTINGS; s++) {
+            if(settings[s].kind == SETTING_RATE) {
+                continue;
+            }
+            printf("#define LEVEL_");
+            for(const char * c = settings[s].name; *c != '\0'; c++) {
+                putchar(toupper((unsigned char)*c));
+            }
+            printf(" %ld\n", level->values[s]);
+        }
+
+        printf("#define LEVEL_ROAD_CURVE_RANGE %ld\n", level_range(level, "road_curve_min", "road_curve_max"));
+        printf("#define LEVEL_ROAD_SECTION_RANGE %ld\n", level_range(level, "road_section_min", "road_section_max"));
+        printf("#define LEVEL_FUEL_STATION_RANGE %ld\n", level_range(level, "fuel_station_min", "fuel_station_max"));
+        printf("#define LEVEL_HAZARD_SPAWN_THRESHOLD %ld\n", level_threshold(level, "hazard_spawn_chance"));
+
+        printf("#define LEVEL_SPEED_RATES { \\\n");
+        for(int s = setting_find("brake"); s <= setting_find("creep_offroad"); s += 2) {
+            printf("    { %ldL, %ldL }, /* %s, %s */ \\\n", level->values[s], level->values[s + 1],
+                level->rates[s], level->rates[s + 1]);
+        }
+        printf("}\n");
+    }
+    printf("#else\n#error \"LEVEL isn't one of the levels in %s\"\n#endif\n", file_name);
+    printf("\n#endif\n");
+}
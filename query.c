@@ -0,0 +1,309 @@
+/***********************************************************************************/
+/* Adds up the telemetry in session files written by the server (see session.h).   */
+/* Whole blocks are added up from their summaries in the index, only the blocks    */
+/* at the ends of the range of time asked for are decoded, and then only the       */
+/* columns that are needed. Times are in seconds of game time, worked out from the */
+/* time column as Max_Time.m does.                                                 */
+/*                                                                                 */
+/* Usage: query.exe [-v] [-d] [-f from] [-t to] file.session...                    */
+/*                                                                                 */
+/*   -v       also prints a line for each session                                  */
+/*   -d       prints every sample as CSV instead of adding them up                 */
+/*   -f, -t   only the samples from and to these times in each game (in seconds)   */
+/***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "session.h"
+
+typedef struct QueryTotals {
+    unsigned long sessions;         // Sessions with samples in the range
+    unsigned long samples;
+    unsigned long dropped;          // Counted for every block with samples in the range
+    unsigned long collisions;
+    double seconds;                 // From the first to the last sample in the range of each session
+    int64_t speed_sum;              // Q8.8
+    int speed_max;
+    unsigned long blocks_summed;    // Blocks added up from their summaries
+    unsigned long blocks_decoded;
+} QueryTotals;
+
+typedef struct QueryRange {
+    double from, to;                // Seconds
+    bool verbose;
+    bool dump;
+} QueryRange;
+
+SessionSummary * query_read_index(FILE * file, uint32_t * blocks);
+uint32_t query_seek(const SessionSummary * index, uint32_t blocks, uint32_t time);
+bool query_block(FILE * file, const char * file_name, const SessionHeader * header, uint32_t block,
+    uint32_t from, uint32_t to, const QueryRange * range, QueryTotals * session, uint32_t * first_time,
+    uint32_t * last_time, uint8_t * distance);
+bool query_file(const char * file_name, const QueryRange * range, QueryTotals * totals);
+void query_add(QueryTotals * totals, const QueryTotals * session);
+
+//-------------------------------------------------------------------
+
+int main(int argc, char *argv[]) {
+    QueryRange range = { .from = 0, .to = INFINITY };
+    int first = 1;
+    for(; (first < argc) && (argv[first][0] == '-'); first++) {
+        if(strcmp(argv[first], "-v") == 0) {
+            range.verbose = true;
+        } else if(strcmp(argv[first], "-d") == 0) {
+            range.dump = true;
+        } else if((strcmp(argv[first], "-f") == 0) && (first + 1 < argc)) {
+            range.from = atof(argv[++first]);
+        } else if((strcmp(argv[first], "-t") == 0) && (first + 1 < argc)) {
+            range.to = atof(argv[++first]);
+        } else {
+            first = argc;
+        }
+    }
+    if(first >= argc) {
+        fprintf(stderr, "Expected the names of one or more session files.\n");
+        fprintf(stderr, "Example: query.exe [-v] [-d] [-f from] [-t to] zombie_race_ttyACM0_1526000000_1.session\n");
+        return 1;
+    }
+
+    if(range.dump) {
+        printf("session,time,step,speed,fuel,distance,player_x,road_x,condition\n");
+    }
+    QueryTotals totals = { 0 };
+    unsigned long failed = 0;
+    for(int i = first; i < argc; i++) {
+        failed += !query_file(argv[i], &range, &totals);
+    }
+    if(range.dump) {
+        return (failed > 0) ? 1 : 0;
+    }
+
+    printf("%lu sessions, %lu samples (%lu dropped), %.1f minutes of game time\n", totals.sessions, totals.samples,
+        totals.dropped, totals.seconds / 60);
+    if(totals.samples > 0) {
+        printf("Average speed %.2f, fastest %.2f\n", totals.speed_sum / 256.0 / totals.samples, totals.speed_max / 256.0);
+    }
+    printf("%lu collisions", totals.collisions);
+    if(totals.seconds > 0) {
+        printf(", %.2f a minute", totals.collisions * 60 / totals.seconds);
+    }
+    printf("\n%lu blocks added up from the index, %lu decoded\n", totals.blocks_summed, totals.blocks_decoded);
+    if(failed > 0) {
+        printf("%lu files couldn't be read\n", failed);
+    }
+    return (failed > 0) ? 1 : 0;
+}
+
+/**
+ * Reads the index of a session file, or the summaries in each block's header if the file
+ * has no index. Returns the summaries (to be freed) or NULL if they can't be read.
+ **/
+SessionSummary * query_read_index(FILE * file, uint32_t * blocks) {
+    if(fseek(file, 0, SEEK_END) != 0) {
+        return NULL;
+    }
+    long size = ftell(file);
+    long data = size - (long)sizeof(SessionHeader);
+
+    SessionTrailer trailer;
+    if((data >= (long)sizeof(trailer)) && (fseek(file, -(long)sizeof(trailer), SEEK_END) == 0) &&
+            (fread(&trailer, sizeof(trailer), 1, file) == 1) && (trailer.magic == SESSION_TRAILER_MAGIC) &&
+            (data == (long)(trailer.blocks * (SESSION_BLOCK_SIZE + sizeof(SessionSummary)) + sizeof(trailer)))) {
+        *blocks = trailer.blocks;
+        SessionSummary * index = malloc(trailer.blocks * sizeof(SessionSummary) + 1);
+        if((index != NULL) && (fseek(file, sizeof(SessionHeader) + (long)trailer.blocks * SESSION_BLOCK_SIZE, SEEK_SET) == 0) &&
+                (fread(index, sizeof(SessionSummary), trailer.blocks, file) == trailer.blocks)) {
+            return index;
+        }
+        free(index);
+        return NULL;
+    }
+
+    // No index, so only the whole blocks are read
+    *blocks = (data > 0) ? (uint32_t)(data / SESSION_BLOCK_SIZE) : 0;
+    SessionSummary * index = malloc(*blocks * sizeof(SessionSummary) + 1);
+    if(index == NULL) {
+        return NULL;
+    }
+    for(uint32_t i = 0; i < *blocks; i++) {
+        if((fseek(file, sizeof(SessionHeader) + (long)i * SESSION_BLOCK_SIZE, SEEK_SET) != 0) ||
+                (fread(&index[i], sizeof(SessionSummary), 1, file) != 1)) {
+            free(index);
+            return NULL;
+        }
+    }
+    return index;
+}
+
+/**
+ * Returns the first block with samples at or after a time (blocks if there are none)
+ **/
+uint32_t query_seek(const SessionSummary * index, uint32_t blocks, uint32_t time) {
+    uint32_t low = 0, high = blocks;
+    while(low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if(index[middle].last_time < time) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/**
+ * Decodes the samples of a block that are from and to two times and adds them to the
+ * session's totals (or prints them with -d). Keeps the times of the first and last samples
+ * added and the distance at the last one.
+ **/
+bool query_block(FILE * file, const char * file_name, const SessionHeader * header, uint32_t block,
+        uint32_t from, uint32_t to, const QueryRange * range, QueryTotals * session, uint32_t * first_time,
+        uint32_t * last_time, uint8_t * distance) {
+    static uint8_t data[SESSION_BLOCK_SIZE];
+    static int32_t values[SESSION_COLUMNS][SESSION_BLOCK_SAMPLES];
+    if((fseek(file, sizeof(SessionHeader) + (long)block * SESSION_BLOCK_SIZE, SEEK_SET) != 0) ||
+            (fread(data, sizeof(data), 1, file) != 1)) {
+        return false;
+    }
+    const SessionBlockHeader * block_header = (const SessionBlockHeader *)data;
+
+    static const enum SessionColumn wanted[] = { SESSION_TIME, SESSION_SPEED, SESSION_DISTANCE, SESSION_CONDITION };
+    for(int c = 0; c < SESSION_COLUMNS; c++) {
+        bool decode = range->dump;
+        for(size_t w = 0; w < sizeof(wanted) / sizeof(wanted[0]); w++) {
+            decode |= ((int)wanted[w] == c);
+        }
+        if(decode && !session_decode_column(data, c, values[c])) {
+            return false;
+        }
+    }
+
+    bool used = false;
+    for(uint16_t i = 0; i < block_header->summary.samples; i++) {
+        uint32_t time = values[SESSION_TIME][i];
+        if((time < from) || (time > to)) {
+            continue;
+        }
+        if(range->dump) {
+            printf("%s,%.3f,%d,%.3f,%.3f,%d,%d,%d,%d\n", file_name, session_seconds(header, time),
+                values[SESSION_STEP][i], values[SESSION_SPEED][i] / 256.0, values[SESSION_FUEL][i] / 256.0,
+                values[SESSION_DISTANCE][i], values[SESSION_PLAYER_X][i], values[SESSION_ROAD_X][i],
+                values[SESSION_CONDITION][i]);
+        }
+        int32_t previous = (i == 0) ? block_header->base[SESSION_CONDITION] : values[SESSION_CONDITION][i - 1];
+        session->collisions += (values[SESSION_CONDITION][i] < previous);
+        session->samples++;
+        session->speed_sum += values[SESSION_SPEED][i];
+        if(values[SESSION_SPEED][i] > session->speed_max) {
+            session->speed_max = values[SESSION_SPEED][i];
+        }
+        if(session->samples == 1) {
+            *first_time = time;
+        }
+        *last_time = time;
+        *distance = values[SESSION_DISTANCE][i];
+        used = true;
+    }
+    if(used) {
+        session->dropped += block_header->summary.dropped;
+    }
+    session->blocks_decoded++;
+    return true;
+}
+
+/**
+ * Adds up the samples of one session file that are in the range of time asked for. Returns
+ * false if the file can't be read.
+ **/
+bool query_file(const char * file_name, const QueryRange * range, QueryTotals * totals) {
+    FILE * file = fopen(file_name, "rb");
+    if(file == NULL) {
+        fprintf(stderr, "%s: unable to open\n", file_name);
+        return false;
+    }
+    SessionHeader header;
+    if((fread(&header, sizeof(header), 1, file) != 1) || (header.magic != SESSION_MAGIC) ||
+            (header.version != SESSION_VERSION) || (header.block_size != SESSION_BLOCK_SIZE) ||
+            (header.columns != SESSION_COLUMNS) || (header.tick_cycles == 0)) {
+        fprintf(stderr, "%s: not a session file from this version\n", file_name);
+        fclose(file);
+        return false;
+    }
+    uint32_t blocks;
+    SessionSummary * index = query_read_index(file, &blocks);
+    if(index == NULL) {
+        fprintf(stderr, "%s: unable to read the index\n", file_name);
+        fclose(file);
+        return false;
+    }
+
+    // The range in ticks of the time column
+    double ticks_per_second = (double)header.cpu_freq / header.tick_cycles;
+    double from_ticks = ceil(range->from * ticks_per_second);
+    double to_ticks = floor(range->to * ticks_per_second);
+    uint32_t from = (from_ticks <= 0) ? 0 : (from_ticks >= UINT32_MAX) ? UINT32_MAX : (uint32_t)from_ticks;
+    uint32_t to = (to_ticks >= UINT32_MAX) ? UINT32_MAX : (to_ticks <= 0) ? 0 : (uint32_t)to_ticks;
+
+    QueryTotals session = { 0 };
+    uint32_t first_time = 0, last_time = 0;
+    uint8_t distance = 0;
+    bool ok = true;
+    for(uint32_t b = query_seek(index, blocks, from); ok && (b < blocks) && (index[b].first_time <= to); b++) {
+        const SessionSummary * summary = &index[b];
+        if(range->dump || (summary->first_time < from) || (summary->last_time > to)) {
+            ok = query_block(file, file_name, &header, b, from, to, range, &session, &first_time, &last_time, &distance);
+            continue;
+        }
+        if(summary->samples == 0) {
+            continue;
+        }
+        if(session.samples == 0) {
+            first_time = summary->first_time;
+        }
+        last_time = summary->last_time;
+        distance = summary->distance;
+        session.samples += summary->samples;
+        session.dropped += summary->dropped;
+        session.collisions += summary->collisions;
+        session.speed_sum += summary->speed_sum;
+        if(summary->speed_max > session.speed_max) {
+            session.speed_max = summary->speed_max;
+        }
+        session.blocks_summed++;
+    }
+    free(index);
+    fclose(file);
+    if(!ok) {
+        fprintf(stderr, "%s: corrupt block\n", file_name);
+        return false;
+    }
+
+    if(session.samples > 0) {
+        session.sessions = 1;
+        session.seconds = session_seconds(&header, last_time - first_time);
+    }
+    if(range->verbose && !range->dump) {
+        printf("%s: %s, %lu samples, %.1f s, average speed %.2f, %lu collisions, distance %u\n", file_name,
+            header.device, session.samples, session.seconds,
+            (session.samples > 0) ? session.speed_sum / 256.0 / session.samples : 0.0, session.collisions, distance);
+    }
+    query_add(totals, &session);
+    return true;
+}
+
+void query_add(QueryTotals * totals, const QueryTotals * session) {
+    totals->sessions += session->sessions;
+    totals->samples += session->samples;
+    totals->dropped += session->dropped;
+    totals->collisions += session->collisions;
+    totals->seconds += session->seconds;
+    totals->speed_sum += session->speed_sum;
+    if(session->speed_max > totals->speed_max) {
+        totals->speed_max = session->speed_max;
+    }
+    totals->blocks_summed += session->blocks_summed;
+    totals->blocks_decoded += session->blocks_decoded;
+}
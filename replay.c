@@ -0,0 +1,196 @@
+/***********************************************************************************/
+/* Replays games recorded by a RECORD build of the game (see REPLAY in             */
+/* zombie_race.h) on the host, as fast as it can. The game is built into this      */
+/* program with HEADLESS defined and the stand-ins in host/ instead of the AVR and */
+/* cab202_teensy headers, then update() is given the recorded inputs one frame at  */
+/* a time. Each game has to end with the same checksum as it did on the Teensy.    */
+/*                                                                                 */
+/* Usage: replay.exe [-v] file.replay...                                           */
+/***********************************************************************************/
+
+#include "a2_n9424342.c"
+
+#include <time.h>
+
+// The biggest message in a replay file
+#define REPLAY_MESSAGE_SIZE sizeof(ReplayInput)
+
+typedef struct ReplayTotals {
+    unsigned long games;
+    unsigned long failed;
+    unsigned long frames;
+} ReplayTotals;
+
+void replay_reset(uint16_t seed);
+void replay_frame(const ReplayFrame * frame);
+bool replay_file(const char * file_name, bool verbose, ReplayTotals * totals);
+
+//-------------------------------------------------------------------
+
+int main(int argc, char *argv[]) {
+    bool verbose = false;
+    int first = 1;
+    if((argc > 1) && (strcmp(argv[1], "-v") == 0)) {
+        verbose = true;
+        first++;
+    }
+    if(first >= argc) {
+        fprintf(stderr, "Expected the names of one or more replay files.\n");
+        fprintf(stderr, "Example: replay.exe [-v] zombie_race_ttyACM0_1526000000.replay\n");
+        return 1;
+    }
+
+    ReplayTotals totals = { 0, 0, 0 };
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool ok = true;
+    for(int i = first; i < argc; i++) {
+        ok &= replay_file(argv[i], verbose, &totals);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%lu games, %lu failed, %lu frames in %.3fs (%.0f frames/s, %.0fx real time)\n",
+        totals.games, totals.failed, totals.frames, seconds, (seconds > 0) ? totals.frames / seconds : 0.0,
+        (seconds > 0) ? totals.frames / (seconds * loop_freq) : 0.0);
+    return (ok && (totals.failed == 0)) ? 0 : 1;
+}
+
+//-------------------------------------------------------------------
+
+/**
+ * Starts a new game the way it was started on the Teensy, with Timer0 showing the seed
+ **/
+void replay_reset(uint16_t seed) {
+    controls_debounced = 0;
+    controls_held = 0;
+    controls_pressed = 0;
+    input_queue_head = input_queue_tail = 0;
+    frame_ticks = 0;
+    load_state = LOAD_IDLE;
+
+    TCNT0 = seed;
+    change_screen(GAME_SCREEN);
+}
+
+/**
+ * Runs one frame with the recorded inputs, with the same steps of the game as the loop in
+ * main(). The controls pressed are queued as if the Timer0 interrupt had seen them. The road
+ * has to be made after each update() as it is on the Teensy, or the checkpoints taken (and
+ * so the games rewound to them) won't match.
+ **/
+void replay_frame(const ReplayFrame * frame) {
+    controls_debounced = frame->held;
+    for(uint8_t control = 0; control < NUM_CONTROLS; control++) {
+        if(frame->pressed & (1 << control)) {
+            input_push(control);
+        }
+    }
+    frame_ticks = frame->ticks;
+    adc_filtered[0] = frame->pot << ADC_FILTER_SHIFT;
+
+    update();
+    road_generate();
+}
+
+/**
+ * Replays every game in a replay file, printing a line for each one. Returns false if the
+ * file couldn't be read.
+ **/
+bool replay_file(const char * file_name, bool verbose, ReplayTotals * totals) {
+    static const char * reasons[] = {
+        [REPLAY_GAME_OVER] = "game over",
+        [REPLAY_LOADED] = "loaded a save",
+    };
+
+    FILE * file = fopen(file_name, "rb");
+    if(file == NULL) {
+        fprintf(stderr, "%s: unable to open\n", file_name);
+        return false;
+    }
+
+    uint8_t message[REPLAY_MESSAGE_SIZE];
+    bool playing = false;
+    unsigned long game_number = 0;
+    uint32_t frames = 0;
+    uint16_t seed = 0;
+    bool ok = true;
+
+    // Every message starts with REPLAY and its kind
+    while(fread(message, 2, 1, file) == 1) {
+        if(message[0] != REPLAY) {
+            fprintf(stderr, "%s: not a replay file\n", file_name);
+            ok = false;
+            break;
+        }
+
+        if(message[1] == REPLAY_START) {
+            ReplayStart start;
+            if(fread(message + 2, sizeof(start) - 2, 1, file) != 1) {
+                break;
+            }
+            memcpy(&start, message, sizeof(start));
+            if(playing) {
+                printf("%s: game %lu, seed %u: ended after %lu frames without a checksum\n",
+                    file_name, game_number, seed, (unsigned long)frames);
+                totals->failed++;
+            }
+            playing = true;
+            game_number++;
+            totals->games++;
+            frames = 0;
+            seed = start.seed;
+            replay_reset(seed);
+        } else if(message[1] == REPLAY_INPUT) {
+            ReplayInput input;
+            if((fread(message + 2, 1, 1, file) != 1) || (message[2] > REPLAY_FRAMES) ||
+                    (fread(message + 3, sizeof(ReplayFrame), message[2], file) != message[2])) {
+                break;
+            }
+            memcpy(&input, message, REPLAY_INPUT_HEADER_SIZE + message[2] * sizeof(ReplayFrame));
+            for(uint8_t i = 0; playing && (i < input.count); i++) {
+                replay_frame(&input.frames[i]);
+                frames++;
+                totals->frames++;
+            }
+        } else if(message[1] == REPLAY_END) {
+            ReplayEnd end;
+            if(fread(message + 2, sizeof(end) - 2, 1, file) != 1) {
+                break;
+            }
+            memcpy(&end, message, sizeof(end));
+            if(!playing) {
+                continue;
+            }
+            playing = false;
+
+            uint16_t checksum = replay_checksum();
+            bool matched = (frames == end.frames) && (checksum == end.checksum);
+            if(!matched) {
+                totals->failed++;
+            }
+            if(verbose || !matched) {
+                printf("%s: game %lu, seed %u, %lu frames (%s): %s, distance %u, condition %u, fuel %d",
+                    file_name, game_number, seed, (unsigned long)frames,
+                    (end.reason <= REPLAY_LOADED) ? reasons[end.reason] : "unknown", matched ? "ok" : "MISMATCH",
+                    game.distance, game.condition, FIX8_ROUND(game.fuel));
+                if(!matched) {
+                    printf(" (expected %lu frames with checksum %04X, got %04X)",
+                        (unsigned long)end.frames, end.checksum, checksum);
+                }
+                printf("\n");
+            }
+        } else {
+            fprintf(stderr, "%s: unknown replay message %d\n", file_name, message[1]);
+            ok = false;
+            break;
+        }
+    }
+
+    if(playing) {
+        printf("%s: game %lu, seed %u: cut short after %lu frames\n", file_name, game_number, seed, (unsigned long)frames);
+        totals->failed++;
+    }
+    fclose(file);
+    return ok;
+}
@@ -0,0 +1,141 @@
+/***********************************************************************************/
+/* Records games for replay.exe to check (make replay-test). The game is built     */
+/* into this program with HEADLESS and RECORD defined, and each frame runs the     */
+/* same steps as the loop in main() on the Teensy, with made up inputs that pause  */
+/* the game and rewind it to its checkpoints. What the game sends is written to    */
+/* the replay file, so when replay.exe plays it back every game has to end with    */
+/* the checksum it was recorded with.                                              */
+/*                                                                                 */
+/* Usage: replay_test.exe file.replay [games]                                      */
+/***********************************************************************************/
+
+#include "a2_n9424342.c"
+
+#define TEST_GAMES          200
+// A game that hasn't ended after this many frames fails the test
+#define TEST_MAX_FRAMES     60000
+// The chances (out of 256) each frame of pausing, of rewinding while paused and of
+// carrying on again
+#define TEST_PAUSE_CHANCE   2
+#define TEST_REWIND_CHANCE  16
+#define TEST_RESUME_CHANCE  32
+
+FILE * test_file;
+uint32_t test_random_state = 1;
+
+uint8_t test_random(void);
+uint8_t test_controls(uint8_t held);
+bool test_game(uint16_t seed);
+
+//-------------------------------------------------------------------
+
+int main(int argc, char *argv[]) {
+    if(argc < 2) {
+        fprintf(stderr, "Expected the name of the replay file to write.\n");
+        fprintf(stderr, "Example: replay_test.exe replay_test.replay [%d]\n", TEST_GAMES);
+        return 1;
+    }
+    int games = (argc > 2) ? atoi(argv[2]) : TEST_GAMES;
+
+    test_file = fopen(argv[1], "wb");
+    if(test_file == NULL) {
+        fprintf(stderr, "%s: unable to open\n", argv[1]);
+        return 1;
+    }
+
+    int unfinished = 0;
+    for(int i = 0; i < games; i++) {
+        unfinished += !test_game(test_random() | (test_random() << 8));
+    }
+    fclose(test_file);
+
+    printf("Recorded %d games to %s\n", games, argv[1]);
+    if(unfinished > 0) {
+        fprintf(stderr, "%d games didn't end within %d frames\n", unfinished, TEST_MAX_FRAMES);
+        return 1;
+    }
+    return 0;
+}
+
+//-------------------------------------------------------------------
+
+/**
+ * Everything the game sends comes here (see host/usb_serial.h). Only the replay is kept.
+ **/
+int8_t host_serial_write(const uint8_t * buffer, uint16_t size) {
+    if(replay_recording && (size > 0) && (buffer[0] == REPLAY)) {
+        fwrite(buffer, size, 1, test_file);
+    }
+    return 0;
+}
+
+/**
+ * A xorshift generator of the test's own, so the inputs don't use up any of the game's
+ * random numbers
+ **/
+uint8_t test_random(void) {
+    test_random_state ^= test_random_state << 13;
+    test_random_state ^= test_random_state >> 17;
+    test_random_state ^= test_random_state << 5;
+    return test_random_state >> 24;
+}
+
+/**
+ * Picks the controls held in the next frame from the ones held in this one. The car is
+ * always accelerating and steers at random. Now and then the game is paused, rewound a few
+ * times and carried on again.
+ **/
+uint8_t test_controls(uint8_t held) {
+    uint8_t next = 1 << ACCEL;
+    if(game_paused) {
+        // A control has to be let go of before it can be pressed again
+        if(!(held & (1 << MOVE_LEFT)) && (test_random() < TEST_REWIND_CHANCE)) {
+            next |= 1 << MOVE_LEFT;
+        } else if(!(held & (1 << PAUSE)) && (test_random() < TEST_RESUME_CHANCE)) {
+            next |= 1 << PAUSE;
+        }
+    } else if(!(held & (1 << PAUSE)) && (test_random() < TEST_PAUSE_CHANCE)) {
+        next |= 1 << PAUSE;
+    } else {
+        uint8_t steer = test_random();
+        if(steer < 80) {
+            next |= 1 << MOVE_LEFT;
+        } else if(steer < 160) {
+            next |= 1 << MOVE_RIGHT;
+        }
+    }
+    return next;
+}
+
+/**
+ * Plays a game from the seed until it ends. Returns false if it didn't end in time.
+ **/
+bool test_game(uint16_t seed) {
+    controls_debounced = 0;
+    input_queue_head = input_queue_tail = 0;
+    frame_ticks = 0;
+    load_state = LOAD_IDLE;
+    TCNT0 = seed;
+    change_screen(GAME_SCREEN);
+
+    for(uint32_t frame = 0; frame < TEST_MAX_FRAMES; frame++) {
+        uint8_t held = test_controls(controls_debounced);
+        for(uint8_t control = 0; control < NUM_CONTROLS; control++) {
+            if((held & ~controls_debounced) & (1 << control)) {
+                input_push(control);
+            }
+        }
+        controls_debounced = held;
+        adc_filtered[0] = (768 + (test_random() % 256)) << ADC_FILTER_SHIFT;
+        // Now and then a frame runs late
+        frame_ticks = (test_random() < 16) ? 2 : 1;
+
+        // The same steps as main(), without the ones that only draw or send
+        update();
+        road_generate();
+        if(!replay_recording) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -3,30 +3,271 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
 #include <cab202_graphics.h>
 #include <cab202_sprites.h>
 #include "cab202_timers.h"
+#include "zombie_race.h"
+#include "session.h"
 
-void setup(const char * serial_device);
-void setup_usb_serial(const char * serial_device);
+// Where the saves from every device are kept
+#define STORE_FILE_NAME         "zombie_race_saves.db"
+// Where each game's telemetry samples are logged (see session.h), numbered from when the
+// server started. The %s is the name of the device, e.g. ttyACM0.
+#define SESSION_FILE_FORMAT     "zombie_race_%s_%ld_%lu.session"
+// The furthest the step can move on from one sample to the next in the same game (a big
+// gap, or one that goes backwards, means a new game has started)
+#define SESSION_MAX_STEP_GAP    4096
+// Where each game recorded by a RECORD build is written, numbered from when the server started
+#define REPLAY_FILE_FORMAT      "zombie_race_%s_%ld_%lu.replay"
+// The devices looked for when none are given on the command line
+#define DEVICE_PATTERN          "/dev/ttyACM*"
+
+// The most devices one server can look after
+#define MAX_DEVICES         64
+#define PATH_LENGTH         256
+// How often devices that aren't connected are looked for (ms)
+#define RESCAN_INTERVAL     1000
+// The size of each device's receive ring buffer, must be a power of two
+#define RX_BUFFER_SIZE      65536
+// The most bytes taken from one device each time around the loop, so a device sending
+// flat out can't keep the keyboard, the other devices and the redraws waiting
+#define RX_BUDGET           (4 * RX_BUFFER_SIZE)
+// The longest line a DEBUG text message can have (including the newline) and the most lines
+#define DEBUG_LINE_LENGTH   100
+#define DEBUG_MAX_LINES     32
+// The biggest message the parser will wait for, anything longer is treated as garbage
+#define MAX_MESSAGE_SIZE    (2 + DEBUG_MAX_LINES * DEBUG_LINE_LENGTH)
+// How long to wait for a Teensy to accept a reply (ms)
+#define USB_SEND_TIMEOUT    1000
+// The shortest time between redraws (ms), so a stream of messages can't hog the terminal
+#define REDRAW_INTERVAL     33
+// The text shown for the selected device, rebuilt by each message it sends (apart from
+// telemetry and replay inputs, which only change the telemetry pane)
+#define VIEW_ROWS           24
+#define VIEW_COLUMNS        100
+// The lines each device's log keeps for scrolling back through, must be a power of two
+#define LOG_LINES           256
+#define LOG_PAGE            10
+// The shortest time between log lines about dropped telemetry samples (ms)
+#define DROPPED_LOG_INTERVAL    1000
+// The speeds of the latest samples, drawn as a graph in the telemetry pane
+#define SPEED_HISTORY       32
+// The panes of the selected device. The telemetry and save slots panes are side by side, the
+// last message and the log are below them.
+#define PANE_ROWS           (STORE_DEVICE_SLOTS + 1)
+#define SLOTS_PANE_X        46
+// The biggest terminal the dashboard will fill
+#define UI_MAX_ROWS         128
+#define UI_MAX_COLUMNS      256
+
+// The save store is a header followed by a fixed number of fixed size records, so it can
+// be mapped and used in place. Each device keeps its last STORE_DEVICE_SLOTS saves.
+#define STORE_MAGIC         0x5352535A      // "ZRSS"
+#define STORE_VERSION       1
+#define STORE_RECORDS       4096
+#define STORE_RECORD_SIZE   256
+#define STORE_HEADER_SIZE   4096            // A page, so the records start on a page boundary
+#define STORE_DEVICE_SLOTS  8
+#define STORE_NAME_LENGTH   32
+#define STORE_NO_RECORD     0xFFFFFFFF
+
+/**
+ * A save from one slot of one device. The save is kept as the frames it was sent in, so a
+ * load can send it straight from the mapping.
+ **/
+typedef union StoreRecord {
+    struct PACKED {
+        char device[STORE_NAME_LENGTH];     // Empty if the record is free
+        uint8_t slot;
+        uint32_t sequence;                  // Larger for newer saves
+        SaveBuffer save;
+    };
+    uint8_t padding[STORE_RECORD_SIZE];
+} StoreRecord;
+
+/**
+ * Before a record is overwritten its old contents are copied into the journal and synced.
+ * If the server dies part way through a write, the record is put back when it next starts.
+ **/
+typedef union StoreHeader {
+    struct PACKED {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t record_size;
+        uint32_t num_records;
+        uint32_t sequence;                  // The sequence number of the newest save
+        uint32_t journal_record;            // The record being written, STORE_NO_RECORD if none
+        StoreRecord journal;                // What that record held before
+    };
+    uint8_t padding[STORE_HEADER_SIZE];
+} StoreHeader;
+
+typedef struct PACKED Store {
+    StoreHeader header;
+    StoreRecord records[STORE_RECORDS];
+} Store;
+
+_Static_assert(offsetof(StoreRecord, save) + sizeof(SaveBuffer) <= STORE_RECORD_SIZE, "A save doesn't fit in a store record");
+_Static_assert(offsetof(StoreHeader, journal) + sizeof(StoreRecord) <= STORE_HEADER_SIZE, "The journal doesn't fit in the store header");
+
+/**
+ * The profiler totals for one device since the server started. They are kept wider than
+ * the records so they don't overflow.
+ **/
+typedef struct ProfileTotals {
+    uint64_t frames, overruns;
+    uint64_t count[NUM_PROFILE_PHASES], time[NUM_PROFILE_PHASES];
+    uint64_t histogram[NUM_PROFILE_PHASES][PROFILE_BUCKETS];
+    uint16_t min[NUM_PROFILE_PHASES], max[NUM_PROFILE_PHASES];
+} ProfileTotals;
+
+/**
+ * The session file a device's telemetry is being logged to. The block being filled is kept
+ * here, with each column built up separately, and written out once the next sample won't
+ * fit.
+ **/
+typedef struct SessionWriter {
+    char file_name[PATH_LENGTH];
+    FILE * file;                    // NULL if there is no session
+    uint32_t blocks;                // Blocks written so far
+    unsigned long samples;
+    SessionBlockHeader block;
+    uint8_t columns[SESSION_COLUMNS][SESSION_BLOCK_PAYLOAD];
+    size_t used;                    // Bytes in all of the columns
+    int32_t last[SESSION_COLUMNS];  // The values of the last sample
+    uint16_t last_step, last_timer; // And the step and time it was sent with
+} SessionWriter;
+
+/**
+ * Everything the server knows about one Teensy
+ **/
+typedef struct Device {
+    char path[PATH_LENGTH];
+    const char * name;              // The last part of the path
+    int fd;                         // -1 while the device isn't connected
+
+    // Bytes received but not processed yet. The counters run freely and are masked when
+    // the buffer is indexed, so rx_head - rx_tail is always the number of bytes.
+    uint8_t rx_buffer[RX_BUFFER_SIZE];
+    size_t rx_head, rx_tail;
+    unsigned long rx_discarded;     // Bytes skipped because they weren't part of a valid message
+
+    uint32_t save_record;           // The record holding the newest save, STORE_NO_RECORD if none
+    SessionWriter session;
+    unsigned long sessions;
+    char replay_file_name[PATH_LENGTH];
+    FILE * replay_file;             // NULL unless a game is being recorded
+    unsigned long replays, replay_frames;
+
+    // Shown on the dashboard
+    const char * mode;              // What the last message was
+    unsigned long messages, saves, loads;
+    unsigned long total_samples, total_dropped;
+    unsigned long dropped_logged;   // total_dropped when the dropped samples were last logged
+    long dropped_log_time;
+    TelemetrySample last_sample;
+    bool has_sample;
+    uint8_t speed_history[SPEED_HISTORY];   // Ring of whole speeds, the newest at total_samples - 1
+    ProfileTotals profile;
+    uint32_t slot_records[STORE_DEVICE_SLOTS];  // The record holding each slot, STORE_NO_RECORD if none
+
+    char view[VIEW_ROWS][VIEW_COLUMNS + 1];
+
+    // Ring of the latest LOG_LINES lines. log_total counts every line logged and is masked
+    // when the ring is indexed, log_scroll is how many lines back from the newest are shown.
+    char log[LOG_LINES][VIEW_COLUMNS + 1];
+    unsigned long log_total;
+    unsigned long log_scroll;
+} Device;
+
+void setup(int argc, char * argv[]);
 void process(void);
-void save(void);
-void debug(void);
-uint8_t usb_receive_string(char *buffer, uint8_t size);
+long now_ms(void);
+
+// Devices
+Device * device_add(const char * path);
+bool device_open(Device * device);
+void device_close(Device * device);
+void devices_scan(void);
+
+// Save store
+void store_open(void);
+void store_sync(const void * data, size_t length);
+uint32_t store_find(const char * device, uint8_t slot);
+uint32_t store_newest(const char * device);
+uint32_t store_write(Device * device, const SaveBuffer * save);
+
+// Receiving
+ssize_t usb_receive(Device * device);
+bool usb_send(Device * device, const void * data, size_t length);
+ssize_t message_length(const Device * device);
+void rx_read(Device * device, uint8_t * destination, size_t length);
+void process_messages(Device * device);
+void dispatch(Device * device, const uint8_t * message, size_t length);
+
+// Messages
+bool decode(Device * device, const SaveBuffer * save_buffer);
+void save(Device * device, const uint8_t * message);
+void load(Device * device);
+void debug(Device * device, const uint8_t * message, size_t length);
+void debug_profile(Device * device, const ProfileRecord * record);
+void telemetry(Device * device, const uint8_t * message);
+bool session_open(Device * device);
+void session_add(Device * device, const TelemetrySample * sample, uint8_t dropped);
+bool session_write_block(Device * device);
+void session_close(Device * device);
+void replay(Device * device, const uint8_t * message, size_t length);
+
+// Screen
+void view_clear(Device * device);
+void view_string(Device * device, int x, int y, const char * text);
+void view_formatted(Device * device, int x, int y, const char * format, ...);
+void log_line(Device * device, const char * format, ...);
+void log_scroll(Device * device, long lines);
+void ui_string(int x, int y, const char * text);
+void ui_formatted(int x, int y, const char * format, ...);
+void ui_flush(void);
+void draw_telemetry_pane(const Device * device, int x, int y);
+void draw_slots_pane(const Device * device, int x, int y);
+int draw_view_pane(const Device * device, int y);
+void draw_log_pane(const Device * device, int y);
+void redraw(void);
 
-FILE *usb_serial;
-FILE *save_file;
+Store * store;
+unsigned long store_saves;          // The number of records in use
+
+Device devices[MAX_DEVICES];
+int num_devices;
+int selected_device;
+bool discover;                      // Whether new devices matching DEVICE_PATTERN are picked up
+long last_scan;
+
+bool screen_dirty;
+long last_redraw;
+time_t server_started;
+
+// The dashboard is put together in ui_back each redraw. ui_front is what the terminal is
+// showing, so only the cells that have changed since the last redraw are drawn.
+char ui_back[UI_MAX_ROWS][UI_MAX_COLUMNS];
+char ui_front[UI_MAX_ROWS][UI_MAX_COLUMNS];
+int ui_rows, ui_columns;            // The size of the terminal at the last redraw
+bool ui_valid;                      // False if the terminal has to be cleared and drawn from scratch
 
 //-------------------------------------------------------------------
 
 int main(int argc, char *argv[]) {
-	if ( argc != 2 ) {
-		fprintf(stderr, "Expected 1 command line argument containing serial device name.\n");
-		fprintf(stderr, "Example: usb_zdk /dev/ttyS3\n");
-		return 1;
-	}
-
-	setup(argv[1]);
+	setup(argc, argv);
 
 	for ( ;; ) {
 		process();
@@ -34,110 +275,1357 @@ int main(int argc, char *argv[]) {
 }
 
 //-------------------------------------------------------------------
+
+/**
+ * Sleeps until a Teensy sends something, a key is pressed, it is time to redraw or it is
+ * time to look for devices again, then deals with it. Every connected device is waited on
+ * in the same poll().
+ **/
 void process(void) {
-    clear_screen();
-    draw_string(1, 1, "Mode:");
+    long now = now_ms();
+    long timeout = RESCAN_INTERVAL - (now - last_scan);
+    if(timeout <= 0) {
+        devices_scan();
+        return;
+    }
+    if(screen_dirty) {
+        long wait = REDRAW_INTERVAL - (now - last_redraw);
+        if(wait <= 0) {
+            redraw();
+            return;
+        }
+        if(wait < timeout) {
+            timeout = wait;
+        }
+    }
+
+    struct pollfd fds[MAX_DEVICES + 1];
+    Device * polled[MAX_DEVICES + 1];
+    int num_fds = 0;
+    fds[num_fds++] = (struct pollfd){ .fd = STDIN_FILENO, .events = POLLIN };
+    for(int i = 0; i < num_devices; i++) {
+        if(devices[i].fd >= 0) {
+            polled[num_fds] = &devices[i];
+            fds[num_fds++] = (struct pollfd){ .fd = devices[i].fd, .events = POLLIN };
+        }
+    }
+
+    if(poll(fds, num_fds, (int)timeout) < 0) {
+        if(errno == EINTR) {
+            return;
+        }
+        cleanup_screen();
+        perror("poll");
+        exit(1);
+    }
+
+    if(fds[0].revents & POLLIN) {
+        int key = get_char();
+        if((key == 'q') || (key == 'Q')) {
+            // Finish the sessions so their files have an index
+            for(int i = 0; i < num_devices; i++) {
+                session_close(&devices[i]);
+            }
+            cleanup_screen();
+            exit(0);
+        }
+        if((num_devices > 0) && ((key == '\t') || (key == 'n'))) {
+            selected_device = (selected_device + 1) % num_devices;
+            screen_dirty = true;
+        }
+        if((num_devices > 0) && (key == 'p')) {
+            selected_device = (selected_device + num_devices - 1) % num_devices;
+            screen_dirty = true;
+        }
+        if(num_devices > 0) {
+            Device * device = &devices[selected_device];
+            switch(key) {
+                case 'k': log_scroll(device, 1); break;
+                case 'j': log_scroll(device, -1); break;
+                case 'b': log_scroll(device, LOG_PAGE); break;
+                case 'f': log_scroll(device, -LOG_PAGE); break;
+                case 'e': log_scroll(device, -(long)device->log_scroll); break;
+                default: break;
+            }
+        }
+    }
+
+    for(int i = 1; i < num_fds; i++) {
+        if(!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+            continue;
+        }
+        // Keep going until the device has nothing more (or has had its share), processing as
+        // the ring fills up. Anything left makes the next poll() return straight away.
+        Device * device = polled[i];
+        ssize_t received = 0;
+        size_t taken = 0;
+        while((taken < RX_BUDGET) && ((received = usb_receive(device)) > 0)) {
+            process_messages(device);
+            taken += received;
+        }
+        if(received < 0) {
+            device_close(device);
+        }
+    }
+}
+
+/**
+ * Returns a monotonic time in milliseconds
+ **/
+long now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
+//-------------------------------------------------------------------
+
+/**
+ * Adds a device to the dashboard and tries to open it. Returns NULL if there's no room.
+ **/
+Device * device_add(const char * path) {
+    if(num_devices >= MAX_DEVICES) {
+        return NULL;
+    }
 
-    char code = fgetc(usb_serial);
+    Device * device = &devices[num_devices++];
+    memset(device, 0, sizeof(*device));
+    snprintf(device->path, sizeof(device->path), "%s", path);
+    const char * slash = strrchr(device->path, '/');
+    device->name = (slash != NULL) ? slash + 1 : device->path;
+    device->fd = -1;
+    device->save_record = store_newest(device->name);
+    for(uint8_t slot = 0; slot < STORE_DEVICE_SLOTS; slot++) {
+        device->slot_records[slot] = store_find(device->name, slot);
+    }
+
+    view_clear(device);
+    view_string(device, 1, 1, "Mode: Disconnected");
+    device->mode = "Disconnected";
+    device_open(device);
+    return device;
+}
+
+/**
+ * Opens a device that isn't connected. Returns false if it can't be opened yet.
+ **/
+bool device_open(Device * device) {
+    if(device->fd >= 0) {
+        return true;
+    }
 
-    switch(code) {
-        case 1:
-            draw_string(7, 1, "Saving");
-            save();
+    device->fd = open(device->path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if(device->fd < 0) {
+        return false;
+    }
+
+    // Messages are binary, so turn off line buffering and any character translation. Reads
+    // return whatever has arrived straight away, poll() does the waiting.
+    struct termios tty;
+    if(tcgetattr(device->fd, &tty) == 0) {
+        cfmakeraw(&tty);
+        tty.c_cc[VMIN] = 0;
+        tty.c_cc[VTIME] = 0;
+        tcsetattr(device->fd, TCSANOW, &tty);
+    }
+    tcflush(device->fd, TCIFLUSH);
+
+    // Anything left over from before isn't going to be finished now
+    device->rx_head = device->rx_tail = 0;
+    view_clear(device);
+    view_string(device, 1, 1, "Mode: Waiting");
+    device->mode = "Waiting";
+    log_line(device, "Connected");
+    return true;
+}
+
+/**
+ * Closes a device that has gone away. It is opened again when it comes back.
+ **/
+void device_close(Device * device) {
+    close(device->fd);
+    device->fd = -1;
+    session_close(device);
+    if(device->replay_file != NULL) {
+        fclose(device->replay_file);
+        device->replay_file = NULL;
+    }
+    view_string(device, 1, 0, "Lost the connection");
+    log_line(device, "Lost the connection");
+    device->mode = "Disconnected";
+    screen_dirty = true;
+}
+
+/**
+ * Tries to open the devices that aren't connected and, when discovering, adds any new
+ * devices matching DEVICE_PATTERN
+ **/
+void devices_scan(void) {
+    last_scan = now_ms();
+
+    for(int i = 0; i < num_devices; i++) {
+        if((devices[i].fd < 0) && device_open(&devices[i])) {
+            screen_dirty = true;
+        }
+    }
+
+    if(!discover) {
+        return;
+    }
+    glob_t paths;
+    if(glob(DEVICE_PATTERN, 0, NULL, &paths) != 0) {
+        return;
+    }
+    for(size_t i = 0; i < paths.gl_pathc; i++) {
+        bool known = false;
+        for(int j = 0; j < num_devices; j++) {
+            if(strcmp(devices[j].path, paths.gl_pathv[i]) == 0) {
+                known = true;
+                break;
+            }
+        }
+        if(!known && (device_add(paths.gl_pathv[i]) != NULL)) {
+            screen_dirty = true;
+        }
+    }
+    globfree(&paths);
+}
+
+//-------------------------------------------------------------------
+
+/**
+ * Maps STORE_FILE_NAME, creating it if it doesn't exist. A write that was cut short is
+ * rolled back and records that don't hold a valid save are freed.
+ **/
+void store_open(void) {
+    int fd = open(STORE_FILE_NAME, O_RDWR | O_CREAT, 0644);
+    struct stat info;
+    if((fd < 0) || (fstat(fd, &info) != 0)) {
+        cleanup_screen();
+        fprintf(stderr, "Unable to open " STORE_FILE_NAME "\n");
+        exit(1);
+    }
+    bool created = (info.st_size == 0);
+    if(created && (ftruncate(fd, sizeof(Store)) != 0)) {
+        cleanup_screen();
+        fprintf(stderr, "Unable to create " STORE_FILE_NAME "\n");
+        exit(1);
+    }
+    if(!created && (info.st_size != sizeof(Store))) {
+        cleanup_screen();
+        fprintf(stderr, STORE_FILE_NAME " is the wrong size for this version of the server\n");
+        exit(1);
+    }
+
+    store = mmap(NULL, sizeof(Store), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(store == MAP_FAILED) {
+        cleanup_screen();
+        perror("mmap");
+        exit(1);
+    }
+
+    StoreHeader * header = &store->header;
+    if(created) {
+        // The file starts out as zeroes, which is an empty record everywhere
+        header->magic = STORE_MAGIC;
+        header->version = STORE_VERSION;
+        header->record_size = STORE_RECORD_SIZE;
+        header->num_records = STORE_RECORDS;
+        header->sequence = 0;
+        header->journal_record = STORE_NO_RECORD;
+        store_sync(header, sizeof(*header));
+    }
+    if((header->magic != STORE_MAGIC) || (header->version != STORE_VERSION) ||
+            (header->record_size != STORE_RECORD_SIZE) || (header->num_records != STORE_RECORDS)) {
+        cleanup_screen();
+        fprintf(stderr, STORE_FILE_NAME " is from a different version of the server\n");
+        exit(1);
+    }
+
+    if(header->journal_record < STORE_RECORDS) {
+        store->records[header->journal_record] = header->journal;
+        store_sync(&store->records[header->journal_record], sizeof(StoreRecord));
+        header->journal_record = STORE_NO_RECORD;
+        store_sync(header, sizeof(*header));
+    }
+
+    for(uint32_t i = 0; i < STORE_RECORDS; i++) {
+        StoreRecord * record = &store->records[i];
+        if(record->device[0] == '\0') {
+            continue;
+        }
+        const SaveImage * image = &record->save.image;
+        if((record->device[STORE_NAME_LENGTH - 1] != '\0') || (record->slot >= STORE_DEVICE_SLOTS) ||
+                (image->header.magic != SAVE_MAGIC) || (image->header.version != SAVE_VERSION) ||
+                (image->header.length != sizeof(SaveState)) || (image->crc != save_crc(image))) {
+            memset(record, 0, sizeof(*record));
+            store_sync(record, sizeof(*record));
+            continue;
+        }
+        store_saves++;
+    }
+}
+
+/**
+ * Writes part of the mapping out to the file and waits for it to get there
+ **/
+void store_sync(const void * data, size_t length) {
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)data & ~(page_size - 1);
+    msync((void *)start, (uintptr_t)data + length - start, MS_SYNC);
+}
+
+/**
+ * Returns the record holding a slot of a device, or STORE_NO_RECORD if it has never been
+ * used. If the device is NULL this finds a free record.
+ **/
+uint32_t store_find(const char * device, uint8_t slot) {
+    for(uint32_t i = 0; i < STORE_RECORDS; i++) {
+        const StoreRecord * record = &store->records[i];
+        if(device == NULL) {
+            if(record->device[0] == '\0') {
+                return i;
+            }
+        } else if((record->slot == slot) && (strncmp(record->device, device, STORE_NAME_LENGTH) == 0)) {
+            return i;
+        }
+    }
+    return STORE_NO_RECORD;
+}
+
+/**
+ * Returns the record holding a device's newest save, or STORE_NO_RECORD if it has none
+ **/
+uint32_t store_newest(const char * device) {
+    uint32_t newest = STORE_NO_RECORD;
+    for(uint32_t i = 0; i < STORE_RECORDS; i++) {
+        const StoreRecord * record = &store->records[i];
+        if((record->device[0] != '\0') && (strncmp(record->device, device, STORE_NAME_LENGTH) == 0) &&
+                ((newest == STORE_NO_RECORD) || (record->sequence > store->records[newest].sequence))) {
+            newest = i;
+        }
+    }
+    return newest;
+}
+
+/**
+ * Writes a save into the slot after the device's newest one, taking over the oldest slot
+ * once they are all used. Returns the record it was written to, or STORE_NO_RECORD if the
+ * store is full.
+ **/
+uint32_t store_write(Device * device, const SaveBuffer * save) {
+    uint8_t slot = 0;
+    if(device->save_record != STORE_NO_RECORD) {
+        slot = (store->records[device->save_record].slot + 1) % STORE_DEVICE_SLOTS;
+    }
+    uint32_t index = device->slot_records[slot];
+    if(index == STORE_NO_RECORD) {
+        index = store_find(NULL, 0);
+        if(index == STORE_NO_RECORD) {
+            return STORE_NO_RECORD;
+        }
+        store_saves++;
+    }
+
+    // Journal what the record holds now, then write it in place
+    StoreHeader * header = &store->header;
+    StoreRecord * record = &store->records[index];
+    header->journal = *record;
+    store_sync(&header->journal, sizeof(header->journal));
+    header->journal_record = index;
+    store_sync(header, sizeof(*header));
+
+    memset(record, 0, sizeof(*record));
+    snprintf(record->device, sizeof(record->device), "%s", device->name);
+    record->slot = slot;
+    record->sequence = ++header->sequence;
+    record->save = *save;
+    store_sync(record, sizeof(*record));
+
+    header->journal_record = STORE_NO_RECORD;
+    store_sync(header, sizeof(*header));
+
+    device->save_record = index;
+    device->slot_records[slot] = index;
+    return index;
+}
+
+//-------------------------------------------------------------------
+
+/**
+ * Reads whatever the device has into its ring buffer without blocking. Returns the number
+ * of bytes read, 0 if there is nothing to read (or no room) and -1 if the device is gone.
+ **/
+ssize_t usb_receive(Device * device) {
+    size_t free_space = RX_BUFFER_SIZE - (device->rx_head - device->rx_tail);
+    size_t head = device->rx_head & (RX_BUFFER_SIZE - 1);
+    // Only read up to the end of the buffer, the rest is read on the next call
+    size_t contiguous = RX_BUFFER_SIZE - head;
+    if(contiguous > free_space) {
+        contiguous = free_space;
+    }
+    if(contiguous == 0) {
+        return 0;
+    }
+
+    ssize_t received = read(device->fd, &device->rx_buffer[head], contiguous);
+    if(received < 0) {
+        return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? 0 : -1;
+    }
+    device->rx_head += received;
+    return received;
+}
+
+/**
+ * Sends data to a Teensy, waiting for it to make room if it has to. Returns false if the
+ * data couldn't all be sent in time.
+ **/
+bool usb_send(Device * device, const void * data, size_t length) {
+    const uint8_t * bytes = data;
+    while(length > 0) {
+        ssize_t sent = write(device->fd, bytes, length);
+        if(sent < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                return false;
+            }
+            struct pollfd fd = { .fd = device->fd, .events = POLLOUT };
+            if(poll(&fd, 1, USB_SEND_TIMEOUT) <= 0) {
+                return false;
+            }
+            continue;
+        }
+        bytes += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+/**
+ * Works out the length of the message at the start of a device's ring buffer. Returns 0 if
+ * more bytes are needed before it is complete, or -1 if it isn't a valid message.
+ **/
+ssize_t message_length(const Device * device) {
+    size_t available = device->rx_head - device->rx_tail;
+    if(available < 1) {
+        return 0;
+    }
+
+    #define RX_PEEK(offset) device->rx_buffer[(device->rx_tail + (offset)) & (RX_BUFFER_SIZE - 1)]
+    size_t length;
+    switch(RX_PEEK(0)) {
+        case SAVE:
+            if(available < 2) {
+                return 0;
+            }
+            if(RX_PEEK(1) != SAVE_NUM_FRAMES) {
+                return -1;
+            }
+            length = 2 + SAVE_NUM_FRAMES * SAVE_FRAME_SIZE;
             break;
-        case 3:
-            draw_string(7, 1, "Debugging");
-            debug();
-        default:
+        case LOAD:
+            length = 1;
+            break;
+        case DEBUG:
+            if(available < 2) {
+                return 0;
+            }
+            if(RX_PEEK(1) == PROFILE_MARKER) {
+                length = 2 + sizeof(ProfileRecord);
+                break;
+            }
+            if(RX_PEEK(1) > DEBUG_MAX_LINES) {
+                return -1;
+            }
+            // A text message ends with the newline of its last line
+            size_t limit = 2 + (size_t)RX_PEEK(1) * DEBUG_LINE_LENGTH;
+            uint8_t lines = 0;
+            for(length = 2; lines < RX_PEEK(1); length++) {
+                if(length >= limit) {
+                    return -1;
+                }
+                if(length >= available) {
+                    return 0;
+                }
+                if(RX_PEEK(length) == '\n') {
+                    lines++;
+                }
+            }
             break;
+        case TELEMETRY:
+            if(available < TELEMETRY_HEADER_SIZE) {
+                return 0;
+            }
+            if(RX_PEEK(1) > TELEMETRY_SAMPLES) {
+                return -1;
+            }
+            length = TELEMETRY_HEADER_SIZE + RX_PEEK(1) * sizeof(TelemetrySample);
+            break;
+        case REPLAY:
+            if(available < 2) {
+                return 0;
+            }
+            if(RX_PEEK(1) == REPLAY_START) {
+                length = sizeof(ReplayStart);
+            } else if(RX_PEEK(1) == REPLAY_END) {
+                length = sizeof(ReplayEnd);
+            } else if(RX_PEEK(1) == REPLAY_INPUT) {
+                if(available < REPLAY_INPUT_HEADER_SIZE) {
+                    return 0;
+                }
+                if(RX_PEEK(2) > REPLAY_FRAMES) {
+                    return -1;
+                }
+                length = REPLAY_INPUT_HEADER_SIZE + RX_PEEK(2) * sizeof(ReplayFrame);
+            } else {
+                return -1;
+            }
+            break;
+        default:
+            return -1;
     }
+    #undef RX_PEEK
 
-    show_screen();
+    return (available >= length) ? (ssize_t)length : 0;
 }
 
-void decode(char* data, int index) {
-    
+/**
+ * Copies bytes out of a device's ring buffer and removes them from it
+ **/
+void rx_read(Device * device, uint8_t * destination, size_t length) {
+    size_t tail = device->rx_tail & (RX_BUFFER_SIZE - 1);
+    size_t first = RX_BUFFER_SIZE - tail;
+    if(first > length) {
+        first = length;
+    }
+    memcpy(destination, &device->rx_buffer[tail], first);
+    memcpy(destination + first, device->rx_buffer, length - first);
+    device->rx_tail += length;
+}
+
+/**
+ * Handles every complete message in a device's ring buffer. Bytes that can't start a
+ * message are skipped one at a time until the parser finds one that can.
+ **/
+void process_messages(Device * device) {
+    uint8_t message[MAX_MESSAGE_SIZE];
+    ssize_t length;
+    while((length = message_length(device)) != 0) {
+        if(length < 0) {
+            device->rx_tail++;
+            device->rx_discarded++;
+            screen_dirty = true;
+            continue;
+        }
+        rx_read(device, message, length);
+        dispatch(device, message, length);
+    }
 }
 
-void save(void) {
-    //uint8_t condition;
-    //double speed;
-    //double fuel;
-    //double distance;
-    //uint16_t game_timer_counter;
-    // Road
-    //uint8_t road[LCD_Y];            // The x-coordinates of each road piece
-    //uint8_t road_counter;           // Counts how many steps the road has taken before being moved horizontally
-    //uint8_t road_curve;             // This decides how many times the road must move before it is moved horizontally
-    //int road_direction;
-    //uint8_t road_section_length;    // How many steps the road has taken in the current length
-    // The player
-    //Sprite player;
-    //Sprite terrain[NUM_TERRAIN];   
-    //Sprite hazard[NUM_HAZARD];  
-    // Fuel station
-    //Sprite fuel_station;
-    //double fuel_station_counter;   // Counts down to when the fuel station can spawn again
+/**
+ * Rebuilds a device's view for a complete message
+ **/
+void dispatch(Device * device, const uint8_t * message, size_t length) {
+    static const char * mode_names[] = {
+        [SAVE] = "Saving",
+        [LOAD] = "Loading",
+        [DEBUG] = "Debugging",
+        [TELEMETRY] = "Telemetry",
+        [REPLAY] = "Recording",
+    };
+
+    device->messages++;
+    device->mode = mode_names[message[0]];
+    screen_dirty = true;
+    // These arrive every few frames, so the view is left showing the last message that had
+    // something to say and the telemetry pane shows what they change
+    bool streamed = (message[0] == TELEMETRY) || ((message[0] == REPLAY) && (message[1] == REPLAY_INPUT));
+    if(streamed) {
+        memset(device->view[1], 0, sizeof(device->view[1]));
+    } else {
+        view_clear(device);
+    }
+    view_string(device, 1, 1, "Mode:");
+    view_string(device, 7, 1, device->mode);
+
+    switch(message[0]) {
+        case SAVE:
+            save(device, message);
+            break;
+        case LOAD:
+            load(device);
+            break;
+        case DEBUG:
+            if(message[1] == PROFILE_MARKER) {
+                ProfileRecord record;
+                memcpy(&record, message + 2, sizeof(record));
+                debug_profile(device, &record);
+            } else {
+                debug(device, message, length);
+            }
+            break;
+        case TELEMETRY:
+            telemetry(device, message);
+            break;
+        case REPLAY:
+            replay(device, message, length);
+            break;
+        default:
+            break;
+    }
+}
+
+//-------------------------------------------------------------------
+
+/**
+ * Checks that the save is complete and from a matching version of the game, then draws
+ * its contents. Returns false if the save can't be used.
+ **/
+bool decode(Device * device, const SaveBuffer * save_buffer) {
+    const SaveImage * image = &save_buffer->image;
+
+    if((image->header.magic != SAVE_MAGIC) || (image->header.version != SAVE_VERSION)) {
+        view_string(device, 1, 3, "Save is from an unknown version of the game");
+        log_line(device, "Save is from an unknown version of the game");
+        return false;
+    }
+    if(image->header.length != sizeof(SaveState)) {
+        view_formatted(device, 1, 3, "Save has the wrong length (%d)", image->header.length);
+        log_line(device, "Save has the wrong length (%d)", image->header.length);
+        return false;
+    }
+    if(image->crc != save_crc(image)) {
+        view_string(device, 1, 3, "Save failed the CRC check");
+        log_line(device, "Save failed the CRC check");
+        return false;
+    }
 
-    int num_lines = fgetc(usb_serial);
-    char data[num_lines][100];
-    int cnt = 0;
-    while((fgets(data[cnt], 100, usb_serial) != NULL) && cnt < num_lines) {
-        data[cnt][strcspn(data[cnt], "\n")] = 0;
-        decode(data[cnt], cnt);
-        cnt++;
+    const GameState * state = &image->state.game;
+    view_formatted(device, 1, 3, "Condition: %d", state->condition);
+    view_formatted(device, 1, 4, "Fuel: %.0f", state->fuel / 256.0);
+    view_formatted(device, 1, 5, "Speed: %.0f", state->speed / 65536.0);
+    view_formatted(device, 1, 6, "Distance: %d (finish in %d)", state->distance, state->finish_line);
+    view_formatted(device, 1, 7, "Timer: %lu (%.3f s)", (unsigned long)image->state.game_timer_counter,
+        (double)image->state.game_timer_counter * SESSION_TICK_CYCLES / SESSION_CPU_FREQ);
+    view_formatted(device, 1, 8, "Road: %d (direction %d, %d steps left)", state->road[state->road_head % ROAD_LENGTH], state->road_direction, state->road_section_length);
+    view_formatted(device, 1, 9, "Player: %d", state->player_x);
+    view_formatted(device, 1, 10, "Fuel station: %d,%d (respawn in %d)", state->fuel_station_x, state->fuel_station_y, state->fuel_station_counter);
+    for(int i=0; i<NUM_HAZARD; i++) {
+        int index = NUM_TERRAIN + i;
+        if(state->obstacle_active & ((ObstacleMask)1 << index)) {
+            view_formatted(device, 1, 11+i, "Hazard %d: %d,%d type %d", i, state->obstacle_x[index], state->obstacle_y[index], state->obstacle_type[index]);
+        } else {
+            view_formatted(device, 1, 11+i, "Hazard %d: not in play", i);
+        }
+    }
+    // The splits are in Timer0 ticks, 256 to an overflow
+    char splits[VIEW_COLUMNS + 1] = "Splits:";
+    for(int i = 0; i < NUM_SPLITS; i++) {
+        size_t length = strlen(splits);
+        if(image->state.split_ticks[i] == 0) {
+            snprintf(splits + length, sizeof(splits) - length, " -");
+        } else {
+            snprintf(splits + length, sizeof(splits) - length, " %.3f",
+                (double)image->state.split_ticks[i] * SESSION_TICK_CYCLES / 256 / SESSION_CPU_FREQ);
+        }
     }
-    for(int i=0; i<cnt; i++) {
-        draw_string(1,i+3,data[i]);
+    view_string(device, 1, 11 + NUM_HAZARD, splits);
+
+    return true;
+}
+
+/**
+ * Writes a save message from a Teensy to its next slot in the store if it is valid. The
+ * parser has already checked the number of frames.
+ **/
+void save(Device * device, const uint8_t * message) {
+    SaveBuffer save_buffer;
+    memcpy(save_buffer.frames, message + 2, sizeof(save_buffer.frames));
+
+    if(decode(device, &save_buffer)) {
+        uint32_t index = store_write(device, &save_buffer);
+        if(index == STORE_NO_RECORD) {
+            view_string(device, 1, 2, STORE_FILE_NAME " is full");
+            log_line(device, "Unable to save, " STORE_FILE_NAME " is full");
+            return;
+        }
+        device->saves++;
+        view_formatted(device, 1, 2, "Saved to slot %d of %s", store->records[index].slot, STORE_FILE_NAME);
+        log_line(device, "Saved to slot %d (distance %d)", store->records[index].slot, save_buffer.image.state.game.distance);
     }
 }
 
-void debug(void) {
-    int num_lines = fgetc(usb_serial);
-    char data[num_lines][100];
-    int cnt = 0;
-    while((fgets(data[cnt], 100, usb_serial) != NULL) && cnt < num_lines) {
-        data[cnt][strcspn(data[cnt], "\n")] = 0;
-        cnt++;
+/**
+ * Sends a Teensy's newest save back to it, straight from the store. The store only holds
+ * valid saves. If there is no save the reply says there are no frames.
+ **/
+void load(Device * device) {
+    uint8_t reply[2] = { LOAD, 0 };
+    const StoreRecord * record = NULL;
+
+    if(device->save_record != STORE_NO_RECORD) {
+        record = &store->records[device->save_record];
+        reply[1] = SAVE_NUM_FRAMES;
+        decode(device, &record->save);
+    } else {
+        view_formatted(device, 1, 3, "No save for %s in " STORE_FILE_NAME, device->name);
+        log_line(device, "Asked for a save but there are none");
+    }
+
+    if(!usb_send(device, reply, sizeof(reply))) {
+        view_string(device, 1, 2, "Unable to reply to the Teensy");
+        log_line(device, "Unable to reply to the Teensy");
+        return;
     }
-    for(int i=0; i<cnt; i++) {
-        draw_string(1,i+3,data[i]);
+    if(record != NULL) {
+        if(!usb_send(device, record->save.frames, sizeof(record->save.frames))) {
+            view_string(device, 1, 2, "Unable to send the save to the Teensy");
+            log_line(device, "Unable to send the save to the Teensy");
+            return;
+        }
+        device->loads++;
+        view_formatted(device, 1, 2, "Sent slot %d from " STORE_FILE_NAME, record->slot);
+        log_line(device, "Sent slot %d", record->slot);
+    }
+}
+
+/**
+ * Shows the lines of a DEBUG text message and adds them to the log
+ **/
+void debug(Device * device, const uint8_t * message, size_t length) {
+    const char * line = (const char *)message + 2;
+    const char * end = (const char *)message + length;
+    for(int i = 0; line < end; i++) {
+        const char * newline = memchr(line, '\n', end - line);
+        char text[DEBUG_LINE_LENGTH];
+        size_t line_length = newline - line;
+        if(line_length >= sizeof(text)) {
+            line_length = sizeof(text) - 1;
+        }
+        memcpy(text, line, line_length);
+        text[line_length] = '\0';
+        view_string(device, 1, i + 3, text);
+        log_line(device, "%s", text);
+        line = newline + 1;
     }
 }
 
 //-------------------------------------------------------------------
 
-void setup(const char * serial_device) {
+/**
+ * Adds the devices given on the command line, or looks for them if there aren't any
+ **/
+void setup(int argc, char * argv[]) {
+	if ( argc - 1 > MAX_DEVICES ) {
+		fprintf(stderr, "Expected at most %d serial device names.\n", MAX_DEVICES);
+		exit(1);
+	}
+	if ( argc == 1 ) {
+		discover = true;
+	}
+	server_started = time(NULL);
+
 	setup_screen();
-	setup_usb_serial(serial_device);
+	store_open();
+	for ( int i = 1; i < argc; i++ ) {
+		device_add(argv[i]);
+	}
+	devices_scan();
+	screen_dirty = true;
 }
 
-// ---------------------------------------------------------
-//	USB serial business.
-// ---------------------------------------------------------
+//-------------------------------------------------------------------
 
-void setup_usb_serial(const char * serial_device) {
-	usb_serial = fopen(serial_device, "r+");
+/**
+ * Shows a ProfileRecord along with the device's totals since the server started
+ **/
+void debug_profile(Device * device, const ProfileRecord * record) {
+    static const char * phase_names[NUM_PROFILE_PHASES] = {
+        [PROFILE_UPDATE] = "update",
+        [PROFILE_DRAW] = "draw",
+        [PROFILE_SHOW_SCREEN] = "show_screen",
+        [PROFILE_ADC] = "adc_read",
+        [PROFILE_FRAME] = "frame",
+    };
+    ProfileTotals * totals = &device->profile;
 
-	if ( usb_serial == NULL ) {
-		fprintf(stderr, "Unable to open device \"%s\"\n", serial_device);
-		exit(1);
-	}
+    if(totals->frames == 0) {
+        for(int phase = 0; phase < NUM_PROFILE_PHASES; phase++) {
+            totals->min[phase] = UINT16_MAX;
+        }
+    }
+    totals->frames += record->frames;
+    totals->overruns += record->overruns;
+
+    view_formatted(device, 1, 3, "Frames: %llu (%llu over budget, %d in the last record)",
+        (unsigned long long)totals->frames, (unsigned long long)totals->overruns, record->overruns);
+    view_formatted(device, 1, 5, "%-12s %7s %7s %7s %9s   %s", "phase (us)", "min", "avg", "max", "last avg", "histogram (<128, <256, ... us)");
+
+    for(int phase = 0; phase < NUM_PROFILE_PHASES; phase++) {
+        const ProfileStats * stats = &record->phases[phase];
+        if(stats->count > 0) {
+            totals->count[phase] += stats->count;
+            totals->time[phase] += stats->total;
+            if(stats->min < totals->min[phase]) {
+                totals->min[phase] = stats->min;
+            }
+            if(stats->max > totals->max[phase]) {
+                totals->max[phase] = stats->max;
+            }
+        }
+
+        char histogram[100] = "";
+        int length = 0;
+        for(int bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+            totals->histogram[phase][bucket] += stats->histogram[bucket];
+            length += snprintf(histogram + length, sizeof(histogram) - length, " %llu", (unsigned long long)totals->histogram[phase][bucket]);
+        }
+
+        if(totals->count[phase] == 0) {
+            view_formatted(device, 1, 6 + phase, "%-12s %7s", phase_names[phase], "-");
+            continue;
+        }
+        unsigned long last_avg = (stats->count > 0) ? (unsigned long)(stats->total / stats->count) : 0;
+        view_formatted(device, 1, 6 + phase, "%-12s %7u %7llu %7u %9lu  %s", phase_names[phase],
+            totals->min[phase], (unsigned long long)(totals->time[phase] / totals->count[phase]), totals->max[phase], last_avg, histogram);
+    }
 }
 
-uint8_t usb_receive_string(char *buffer, uint8_t size) {
-    int tmp;
+/**
+ * Adds the samples of a TelemetryMessage to the device's session file and keeps the speeds
+ * for the telemetry pane. The files are flushed when the screen is redrawn rather than
+ * after every message.
+ **/
+void telemetry(Device * device, const uint8_t * message) {
+    TelemetryMessage telemetry_message;
+    memcpy(&telemetry_message, message, TELEMETRY_HEADER_SIZE + message[1] * sizeof(TelemetrySample));
+    int count = telemetry_message.count;
+    for(int i = 0; i < count; i++) {
+        int speed = telemetry_message.samples[i].speed / 256;
+        device->speed_history[(device->total_samples + i) % SPEED_HISTORY] = (speed < 0) ? 0 : speed;
+    }
+    device->total_samples += count;
+    device->total_dropped += telemetry_message.dropped;
+    // A Teensy that is dropping samples drops them in every message, so they're added up
+    long now = now_ms();
+    if((device->total_dropped != device->dropped_logged) && (now - device->dropped_log_time >= DROPPED_LOG_INTERVAL)) {
+        log_line(device, "%lu telemetry samples dropped by the Teensy", device->total_dropped - device->dropped_logged);
+        device->dropped_logged = device->total_dropped;
+        device->dropped_log_time = now;
+    }
+    if(count > 0) {
+        device->last_sample = telemetry_message.samples[count - 1];
+        device->has_sample = true;
+    }
+
+    for(int i = 0; i < count; i++) {
+        session_add(device, &telemetry_message.samples[i], (i == 0) ? telemetry_message.dropped : 0);
+    }
+}
+
+/**
+ * Starts a new session file for a device. Returns false if it can't be created.
+ **/
+bool session_open(Device * device) {
+    SessionWriter * session = &device->session;
+    memset(session, 0, sizeof(*session));
+    snprintf(session->file_name, sizeof(session->file_name), SESSION_FILE_FORMAT, device->name,
+        (long)server_started, ++device->sessions);
+    session->file = fopen(session->file_name, "w+b");
+    if(session->file == NULL) {
+        log_line(device, "Unable to open %s", session->file_name);
+        return false;
+    }
+
+    SessionHeader header = {
+        .magic = SESSION_MAGIC,
+        .version = SESSION_VERSION,
+        .block_size = SESSION_BLOCK_SIZE,
+        .columns = SESSION_COLUMNS,
+        .tick_cycles = SESSION_TICK_CYCLES,
+        .cpu_freq = SESSION_CPU_FREQ,
+        .started = time(NULL),
+    };
+    snprintf(header.device, sizeof(header.device), "%s", device->name);
+    if(fwrite(&header, sizeof(header), 1, session->file) != 1) {
+        log_line(device, "Unable to write to %s", session->file_name);
+        fclose(session->file);
+        session->file = NULL;
+        return false;
+    }
+    log_line(device, "Logging the telemetry to %s", session->file_name);
+    return true;
+}
+
+/**
+ * Adds a sample to a device's session, starting a new session when a new game starts.
+ * dropped is the number of samples the game dropped before it.
+ **/
+void session_add(Device * device, const TelemetrySample * sample, uint8_t dropped) {
+    SessionWriter * session = &device->session;
+    // The step and the time both start again from 0 in a new game. Either can wrap, but
+    // they don't wrap at the same sample.
+    if((session->file != NULL) && (session->samples > 0) &&
+            (((uint16_t)(sample->step - session->last_step) > SESSION_MAX_STEP_GAP) ||
+            ((sample->step < session->last_step) && (sample->timer < session->last_timer)))) {
+        session_close(device);
+    }
+    if((session->file == NULL) && !session_open(device)) {
+        return;
+    }
+
+    // The time and step carry on counting past where the game's wrap
+    int32_t values[SESSION_COLUMNS];
+    bool first = (session->samples == 0);
+    values[SESSION_TIME] = first ? sample->timer : session->last[SESSION_TIME] + (uint16_t)(sample->timer - session->last_timer);
+    values[SESSION_STEP] = first ? sample->step : session->last[SESSION_STEP] + (uint16_t)(sample->step - session->last_step);
+    values[SESSION_SPEED] = sample->speed;
+    values[SESSION_FUEL] = sample->fuel;
+    values[SESSION_DISTANCE] = sample->distance;
+    values[SESSION_PLAYER_X] = sample->player_x;
+    values[SESSION_ROAD_X] = sample->road_x;
+    values[SESSION_CONDITION] = sample->condition;
+    const int32_t * previous = first ? values : session->last;
 
-    uint8_t count = 0;
-    while(count < size) {
-        tmp = fgetc(usb_serial);
-        if(tmp != -1) {
-            *buffer++ = tmp;
-            count++;
+    uint8_t encoded[SESSION_COLUMNS][SESSION_VARINT_MAX];
+    uint8_t lengths[SESSION_COLUMNS];
+    size_t total = 0;
+    for(int c = 0; c < SESSION_COLUMNS; c++) {
+        lengths[c] = session_put_varint(encoded[c], session_zigzag(values[c] - previous[c]));
+        total += lengths[c];
+    }
+
+    SessionBlockHeader * block = &session->block;
+    if((block->summary.samples > 0) && (session->used + total > SESSION_BLOCK_PAYLOAD)) {
+        if(!session_write_block(device)) {
+            return;
         }
     }
+    if(block->summary.samples == 0) {
+        memcpy(block->base, previous, sizeof(block->base));
+        block->summary.first_time = values[SESSION_TIME];
+        block->summary.speed_max = sample->speed;
+    }
+    for(int c = 0; c < SESSION_COLUMNS; c++) {
+        memcpy(session->columns[c] + block->length[c], encoded[c], lengths[c]);
+        block->length[c] += lengths[c];
+    }
+    session->used += total;
 
-    return count;
+    SessionSummary * summary = &block->summary;
+    summary->samples++;
+    summary->dropped += dropped;
+    summary->collisions += (values[SESSION_CONDITION] < previous[SESSION_CONDITION]);
+    summary->last_time = values[SESSION_TIME];
+    summary->speed_sum += sample->speed;
+    if(sample->speed > summary->speed_max) {
+        summary->speed_max = sample->speed;
+    }
+    summary->distance = sample->distance;
+
+    memcpy(session->last, values, sizeof(session->last));
+    session->last_step = sample->step;
+    session->last_timer = sample->timer;
+    session->samples++;
+}
+
+/**
+ * Writes the block being filled to the end of the session file and starts the next one.
+ * Returns false (and closes the session) if it can't be written.
+ **/
+bool session_write_block(Device * device) {
+    SessionWriter * session = &device->session;
+    uint8_t data[SESSION_BLOCK_SIZE] = { 0 };
+    memcpy(data, &session->block, sizeof(session->block));
+    size_t offset = sizeof(session->block);
+    for(int c = 0; c < SESSION_COLUMNS; c++) {
+        memcpy(data + offset, session->columns[c], session->block.length[c]);
+        offset += session->block.length[c];
+    }
+
+    if(fwrite(data, sizeof(data), 1, session->file) != 1) {
+        log_line(device, "Unable to write to %s", session->file_name);
+        fclose(session->file);
+        session->file = NULL;
+        return false;
+    }
+    session->blocks++;
+    memset(&session->block, 0, sizeof(session->block));
+    session->used = 0;
+    return true;
 }
 
-//-------------------------------------------------------------------
\ No newline at end of file
+/**
+ * Finishes a device's session: writes the last block, then the index of block summaries
+ * (read back from the blocks' headers) and the trailer.
+ **/
+void session_close(Device * device) {
+    SessionWriter * session = &device->session;
+    if(session->file == NULL) {
+        return;
+    }
+    if((session->block.summary.samples > 0) && !session_write_block(device)) {
+        return;
+    }
+
+    bool written = true;
+    for(uint32_t i = 0; written && (i < session->blocks); i++) {
+        SessionSummary summary;
+        written = (fseek(session->file, sizeof(SessionHeader) + (long)i * SESSION_BLOCK_SIZE, SEEK_SET) == 0) &&
+            (fread(&summary, sizeof(summary), 1, session->file) == 1) &&
+            (fseek(session->file, 0, SEEK_END) == 0) &&
+            (fwrite(&summary, sizeof(summary), 1, session->file) == 1);
+    }
+    SessionTrailer trailer = { .magic = SESSION_TRAILER_MAGIC, .blocks = session->blocks };
+    written = written && (fwrite(&trailer, sizeof(trailer), 1, session->file) == 1);
+    written = (fclose(session->file) == 0) && written;
+    session->file = NULL;
+    if(written) {
+        log_line(device, "Logged %lu samples to %s", session->samples, session->file_name);
+    } else {
+        log_line(device, "Unable to write the index of %s", session->file_name);
+    }
+}
+
+/**
+ * Writes a REPLAY message to the file of the game being recorded, starting a new file when
+ * a game starts. The messages are written as they are, replay.c reads them back.
+ **/
+void replay(Device * device, const uint8_t * message, size_t length) {
+    if(message[1] == REPLAY_START) {
+        if(device->replay_file != NULL) {
+            fclose(device->replay_file);
+        }
+        snprintf(device->replay_file_name, sizeof(device->replay_file_name), REPLAY_FILE_FORMAT, device->name,
+            (long)server_started, ++device->replays);
+        device->replay_file = fopen(device->replay_file_name, "wb");
+        device->replay_frames = 0;
+        if(device->replay_file != NULL) {
+            log_line(device, "Recording to %s", device->replay_file_name);
+        } else {
+            log_line(device, "Unable to open %s", device->replay_file_name);
+        }
+    }
+    if(device->replay_file == NULL) {
+        // The telemetry pane says so for the inputs, which would otherwise flood the log
+        if(message[1] != REPLAY_INPUT) {
+            view_string(device, 1, 2, "Not recording (the start of the game was missed)");
+        }
+        return;
+    }
+
+    fwrite(message, length, 1, device->replay_file);
+    if(message[1] == REPLAY_INPUT) {
+        device->replay_frames += message[2];
+        return;
+    }
+    view_formatted(device, 1, 2, "Recording to %s (%lu frames)", device->replay_file_name, device->replay_frames);
+
+    if(message[1] == REPLAY_END) {
+        fclose(device->replay_file);
+        device->replay_file = NULL;
+        ReplayEnd end;
+        memcpy(&end, message, sizeof(end));
+        const char * reason = (end.reason == REPLAY_LOADED) ? "loaded a save" : "game over";
+        view_formatted(device, 1, 3, "Finished (%s), checksum %04X", reason, end.checksum);
+        log_line(device, "Recorded %lu frames (%s), checksum %04X", device->replay_frames, reason, end.checksum);
+    }
+}
+
+//-------------------------------------------------------------------
+
+/**
+ * Empties a device's view
+ **/
+void view_clear(Device * device) {
+    memset(device->view, 0, sizeof(device->view));
+    screen_dirty = true;
+}
+
+/**
+ * Puts text into a device's view, padding the row with spaces up to x. Anything off the
+ * view is cut off.
+ **/
+void view_string(Device * device, int x, int y, const char * text) {
+    if((x < 0) || (y < 0) || (x >= VIEW_COLUMNS) || (y >= VIEW_ROWS)) {
+        return;
+    }
+
+    // Everything after the end of a row is always zero, so the row stays terminated
+    char * row = device->view[y];
+    size_t length = strlen(row);
+    while(length < (size_t)x) {
+        row[length++] = ' ';
+    }
+    size_t text_length = strlen(text);
+    if(x + text_length > VIEW_COLUMNS) {
+        text_length = VIEW_COLUMNS - x;
+    }
+    memcpy(row + x, text, text_length);
+    screen_dirty = true;
+}
+
+void view_formatted(Device * device, int x, int y, const char * format, ...) {
+    char text[VIEW_COLUMNS + 1];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    view_string(device, x, y, text);
+}
+
+/**
+ * Adds a line to a device's log, with the time it was logged. While the log is scrolled
+ * back it stays on the lines being read.
+ **/
+void log_line(Device * device, const char * format, ...) {
+    char * line = device->log[device->log_total & (LOG_LINES - 1)];
+    time_t now = time(NULL);
+    size_t length = strftime(line, VIEW_COLUMNS + 1, "%H:%M:%S ", localtime(&now));
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line + length, VIEW_COLUMNS + 1 - length, format, args);
+    va_end(args);
+
+    device->log_total++;
+    if(device->log_scroll > 0) {
+        log_scroll(device, 1);
+    }
+    screen_dirty = true;
+}
+
+/**
+ * Scrolls a device's log back (positive) or forward (negative) by a number of lines, no
+ * further than the oldest line kept or the newest line
+ **/
+void log_scroll(Device * device, long lines) {
+    long kept = (device->log_total < LOG_LINES) ? (long)device->log_total : LOG_LINES;
+    long scroll = (long)device->log_scroll + lines;
+    if(scroll > kept - 1) {
+        scroll = kept - 1;
+    }
+    if(scroll < 0) {
+        scroll = 0;
+    }
+    device->log_scroll = scroll;
+    screen_dirty = true;
+}
+
+/**
+ * Puts text into the next frame of the dashboard. Anything off the screen is cut off.
+ **/
+void ui_string(int x, int y, const char * text) {
+    if((y < 0) || (y >= ui_rows)) {
+        return;
+    }
+    for(; (*text != '\0') && (x < ui_columns); text++, x++) {
+        if(x >= 0) {
+            ui_back[y][x] = *text;
+        }
+    }
+}
+
+void ui_formatted(int x, int y, const char * format, ...) {
+    char text[UI_MAX_COLUMNS + 1];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    ui_string(x, y, text);
+}
+
+/**
+ * Draws the cells of the new frame that are different from what the terminal shows, so a
+ * redraw only costs as much as what has changed
+ **/
+void ui_flush(void) {
+    for(int y = 0; y < ui_rows; y++) {
+        if(memcmp(ui_back[y], ui_front[y], ui_columns) == 0) {
+            continue;
+        }
+        for(int x = 0; x < ui_columns; x++) {
+            if(ui_back[y][x] != ui_front[y][x]) {
+                draw_char(x, y, ui_back[y][x]);
+                ui_front[y][x] = ui_back[y][x];
+            }
+        }
+    }
+    show_screen();
+}
+
+/**
+ * Draws the latest telemetry sample of a device, a graph of the latest speeds and where
+ * its telemetry and replay are going
+ **/
+void draw_telemetry_pane(const Device * device, int x, int y) {
+    ui_string(x, y, "Telemetry");
+    if(device->has_sample) {
+        const TelemetrySample * sample = &device->last_sample;
+        ui_formatted(x, y + 1, "Step: %-6u  Distance: %u", sample->step, sample->distance);
+        ui_formatted(x, y + 2, "Speed: %-5.1f  Fuel: %.1f", sample->speed / 256.0, sample->fuel / 256.0);
+        ui_formatted(x, y + 3, "Player x: %-3u  Road x: %u", sample->player_x, sample->road_x);
+    } else {
+        ui_string(x, y + 1, "No samples yet");
+    }
+    ui_formatted(x, y + 4, "Samples: %lu (%lu dropped)", device->total_samples, device->total_dropped);
+
+    // Each speed is a column of the graph, scaled to the fastest of them
+    static const char levels[] = " _.-=+*#";
+    unsigned long count = (device->total_samples < SPEED_HISTORY) ? device->total_samples : SPEED_HISTORY;
+    int fastest = 1;
+    for(unsigned long i = 0; i < count; i++) {
+        int speed = device->speed_history[(device->total_samples - 1 - i) % SPEED_HISTORY];
+        fastest = (speed > fastest) ? speed : fastest;
+    }
+    char graph[SPEED_HISTORY + 1];
+    memset(graph, ' ', SPEED_HISTORY);
+    graph[SPEED_HISTORY] = '\0';
+    for(unsigned long i = 0; i < count; i++) {
+        int speed = device->speed_history[(device->total_samples - 1 - i) % SPEED_HISTORY];
+        graph[SPEED_HISTORY - 1 - i] = levels[speed * (int)(sizeof(levels) - 2) / fastest];
+    }
+    ui_formatted(x, y + 5, "Speed |%s| %d", graph, fastest);
+
+    if(device->session.file != NULL) {
+        ui_formatted(x, y + 6, "Logging to %s", device->session.file_name);
+    } else {
+        ui_string(x, y + 6, "Not logging");
+    }
+    if(device->replay_file != NULL) {
+        ui_formatted(x, y + 7, "Recording (%lu frames)", device->replay_frames);
+    } else {
+        ui_string(x, y + 7, "Not recording");
+    }
+}
+
+/**
+ * Draws what each of a device's save slots holds, marking the newest save
+ **/
+void draw_slots_pane(const Device * device, int x, int y) {
+    ui_string(x, y, "Save slots");
+    for(uint8_t slot = 0; slot < STORE_DEVICE_SLOTS; slot++) {
+        uint32_t index = device->slot_records[slot];
+        char newest = ((index != STORE_NO_RECORD) && (index == device->save_record)) ? '*' : ' ';
+        if(index == STORE_NO_RECORD) {
+            ui_formatted(x, y + 1 + slot, " %d  empty", slot);
+            continue;
+        }
+        const StoreRecord * record = &store->records[index];
+        const SaveImage * image = &record->save.image;
+        if((image->header.magic != SAVE_MAGIC) || (image->header.version != SAVE_VERSION)) {
+            ui_formatted(x, y + 1 + slot, "%c%d  #%-6u from another version", newest, slot, record->sequence);
+            continue;
+        }
+        const GameState * game = &image->state.game;
+        ui_formatted(x, y + 1 + slot, "%c%d  #%-6u dist %3u  cond %3u  fuel %5.1f", newest, slot, record->sequence,
+            game->distance, game->condition, game->fuel / 256.0);
+    }
+}
+
+/**
+ * Draws the view of the last message a device sent, leaving out the empty rows at the end.
+ * Returns the row after it.
+ **/
+int draw_view_pane(const Device * device, int y) {
+    int rows = VIEW_ROWS;
+    while((rows > 0) && (device->view[rows - 1][0] == '\0')) {
+        rows--;
+    }
+    for(int i = 0; i < rows; i++) {
+        ui_string(0, y + i, device->view[i]);
+    }
+    return y + rows;
+}
+
+/**
+ * Draws as much of a device's log as fits between a row and the bottom of the screen, the
+ * newest line shown at the bottom
+ **/
+void draw_log_pane(const Device * device, int y) {
+    if(device->log_scroll > 0) {
+        ui_formatted(1, y, "---- log, %lu lines back   j/k: line   b/f: page   e: newest ----", device->log_scroll);
+    } else {
+        ui_string(1, y, "---- log   j/k: line   b/f: page   e: newest ----");
+    }
+
+    int rows = ui_rows - y - 1;
+    unsigned long kept = (device->log_total < LOG_LINES) ? device->log_total : LOG_LINES;
+    // Counts lines back from the newest one, the bottom row shows log_scroll lines back
+    for(int i = 0; i < rows; i++) {
+        unsigned long back = device->log_scroll + i;
+        if(back >= kept) {
+            break;
+        }
+        ui_string(1, ui_rows - 1 - i, device->log[(device->log_total - 1 - back) & (LOG_LINES - 1)]);
+    }
+}
+
+/**
+ * Draws the dashboard: a row for every device followed by the panes of the selected one.
+ * The terminal is only cleared when its size changes, otherwise just the cells that have
+ * changed are drawn (see ui_flush()).
+ **/
+void redraw(void) {
+    int rows = screen_height(), columns = screen_width();
+    rows = (rows > UI_MAX_ROWS) ? UI_MAX_ROWS : (rows < 0) ? 0 : rows;
+    columns = (columns > UI_MAX_COLUMNS) ? UI_MAX_COLUMNS : (columns < 0) ? 0 : columns;
+    if(!ui_valid || (rows != ui_rows) || (columns != ui_columns)) {
+        clear_screen();
+        memset(ui_front, ' ', sizeof(ui_front));
+        ui_rows = rows;
+        ui_columns = columns;
+        ui_valid = true;
+    }
+    memset(ui_back, ' ', sizeof(ui_back));
+
+    int connected = 0;
+    for(int i = 0; i < num_devices; i++) {
+        connected += (devices[i].fd >= 0);
+    }
+    ui_formatted(1, 0, "%d devices, %d connected, %lu saves stored   tab/n/p: select device   q: quit",
+        num_devices, connected, store_saves);
+    if(num_devices == 0) {
+        ui_string(1, 2, discover ? "Looking for " DEVICE_PATTERN : "No devices");
+    } else {
+        ui_formatted(1, 2, "  %-12s %-12s %8s %9s %8s %6s %6s %6s %5s %5s %8s", "device", "mode", "messages",
+            "samples", "dropped", "step", "speed", "fuel", "dist", "saves", "skipped");
+    }
+
+    for(int i = 0; i < num_devices; i++) {
+        Device * device = &devices[i];
+        char sample[40] = "";
+        if(device->has_sample) {
+            snprintf(sample, sizeof(sample), "%6u %6.1f %6.1f %5u", device->last_sample.step,
+                device->last_sample.speed / 256.0, device->last_sample.fuel / 256.0, device->last_sample.distance);
+        } else {
+            snprintf(sample, sizeof(sample), "%6s %6s %6s %5s", "-", "-", "-", "-");
+        }
+        ui_formatted(1, 3 + i, "%c %-12.12s %-12s %8lu %9lu %8lu %s %5lu %8lu", (i == selected_device) ? '>' : ' ',
+            device->name, device->mode, device->messages, device->total_samples, device->total_dropped, sample,
+            device->saves, device->rx_discarded);
+
+        if(device->session.file != NULL) {
+            fflush(device->session.file);
+        }
+        if(device->replay_file != NULL) {
+            fflush(device->replay_file);
+        }
+    }
+
+    if(num_devices > 0) {
+        Device * device = &devices[selected_device];
+        int top = 4 + num_devices;
+        ui_formatted(1, top, "---- %s ----", device->path);
+        draw_telemetry_pane(device, 1, top + 1);
+        draw_slots_pane(device, SLOTS_PANE_X, top + 1);
+        int bottom = draw_view_pane(device, top + 2 + PANE_ROWS);
+        draw_log_pane(device, bottom + 1);
+    }
+
+    ui_flush();
+    screen_dirty = false;
+    last_redraw = now_ms();
+}
@@ -0,0 +1,176 @@
+/***********************************************************************************/
+/* The telemetry session files written by the server (server.c) and read by the    */
+/* query tool (query.c). A session is one game on one device.                      */
+/*                                                                                 */
+/* A session file is a SessionHeader followed by blocks of SESSION_BLOCK_SIZE      */
+/* bytes, so block n is at sizeof(SessionHeader) + n * SESSION_BLOCK_SIZE. Each    */
+/* block is a SessionBlockHeader followed by its columns, one after another. A     */
+/* column holds a value of every sample in the block, each one written as the      */
+/* difference from the sample before it (the block header's base for the first    */
+/* one), zigzag encoded and then written as a varint. The rest of the block is     */
+/* zeroes.                                                                         */
+/*                                                                                 */
+/* When the session ends the index is written after the blocks: the summary of     */
+/* each block in order, then a SessionTrailer. A file without a trailer (the       */
+/* server stopped part way through a session) can still be read, as every block    */
+/* has its summary in its header.                                                  */
+/***********************************************************************************/
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "zombie_race.h"
+
+#define SESSION_MAGIC           0x5354525A      // "ZRTS"
+#define SESSION_TRAILER_MAGIC   0x5849525A      // "ZRIX"
+#define SESSION_VERSION         1
+#define SESSION_BLOCK_SIZE      4096
+#define SESSION_NAME_LENGTH     32
+// The longest varint, a 32 bit number 7 bits at a time
+#define SESSION_VARINT_MAX      5
+
+// The time column counts Timer0 overflows since the game started (game_timer_counter). As in
+// Max_Time.m, each one is 256 counts of Timer0 with a prescaler of 256 on an 8 MHz clock.
+#define SESSION_TICK_CYCLES     (256UL * 256UL)
+#define SESSION_CPU_FREQ        8000000UL
+
+/**
+ * The columns, in the order they are written in each block. The time and the step are
+ * counted from the start of the game, so they don't wrap like the 16 bit ones sent by the
+ * game.
+ **/
+enum SessionColumn {
+    SESSION_TIME = 0,
+    SESSION_STEP = 1,
+    SESSION_SPEED = 2,          // Q8.8
+    SESSION_FUEL = 3,           // Q8.8
+    SESSION_DISTANCE = 4,
+    SESSION_PLAYER_X = 5,
+    SESSION_ROAD_X = 6,
+    SESSION_CONDITION = 7,      // Goes down by the damage of each collision
+    SESSION_COLUMNS = 8
+};
+
+typedef struct PACKED SessionHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t block_size;
+    uint8_t columns;
+    uint32_t tick_cycles;       // The CPU cycles in one tick of the time column
+    uint32_t cpu_freq;
+    int64_t started;            // When the session started (seconds since 1970)
+    char device[SESSION_NAME_LENGTH];
+} SessionHeader;
+
+/**
+ * What a block holds, so the blocks in a range of time can be added up without decoding
+ * them
+ **/
+typedef struct PACKED SessionSummary {
+    uint16_t samples;
+    uint16_t dropped;           // Samples the game dropped while the block was being filled
+    uint16_t collisions;        // Samples with less condition than the one before them
+    uint32_t first_time;        // The time of the first and last samples
+    uint32_t last_time;
+    int32_t speed_sum;          // Q8.8
+    int16_t speed_max;          // Q8.8
+    uint8_t distance;           // At the last sample
+} SessionSummary;
+
+typedef struct PACKED SessionBlockHeader {
+    SessionSummary summary;
+    int32_t base[SESSION_COLUMNS];      // The values of the sample before the first one
+    uint16_t length[SESSION_COLUMNS];   // The bytes in each column
+} SessionBlockHeader;
+
+typedef struct PACKED SessionTrailer {
+    uint32_t magic;
+    uint32_t blocks;            // The number of blocks, and of summaries in the index
+} SessionTrailer;
+
+#define SESSION_BLOCK_PAYLOAD   (SESSION_BLOCK_SIZE - sizeof(SessionBlockHeader))
+// Every sample takes at least a byte in each column
+#define SESSION_BLOCK_SAMPLES   (SESSION_BLOCK_PAYLOAD / SESSION_COLUMNS)
+
+/**
+ * Zigzag encoding, so small differences either way make short varints
+ **/
+static inline uint32_t session_zigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t session_unzigzag(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+/**
+ * Writes a number 7 bits at a time, lowest first, with the top bit set on all but the last
+ * byte. Returns the number of bytes written (up to SESSION_VARINT_MAX).
+ **/
+static inline uint8_t session_put_varint(uint8_t * out, uint32_t value) {
+    uint8_t length = 0;
+    while(value >= 0x80) {
+        out[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (uint8_t)value;
+    return length;
+}
+
+/**
+ * Reads a varint from no more than length bytes. Returns the number of bytes read, or 0 if
+ * the varint doesn't end in time.
+ **/
+static inline size_t session_get_varint(const uint8_t * in, size_t length, uint32_t * value) {
+    uint32_t result = 0;
+    for(size_t i = 0; (i < length) && (i < SESSION_VARINT_MAX); i++) {
+        result |= (uint32_t)(in[i] & 0x7F) << (7 * i);
+        if(!(in[i] & 0x80)) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Decodes one column of a block into values (which has room for SESSION_BLOCK_SAMPLES).
+ * Only the columns that are wanted have to be decoded. Returns false if the block is
+ * corrupt.
+ **/
+static inline bool session_decode_column(const uint8_t * block, enum SessionColumn column, int32_t * values) {
+    const SessionBlockHeader * header = (const SessionBlockHeader *)block;
+    size_t offset = sizeof(SessionBlockHeader);
+    for(int c = 0; c < (int)column; c++) {
+        offset += header->length[c];
+    }
+    size_t end = offset + header->length[column];
+    if((end > SESSION_BLOCK_SIZE) || (header->summary.samples > SESSION_BLOCK_SAMPLES)) {
+        return false;
+    }
+
+    int32_t value = header->base[column];
+    for(uint16_t i = 0; i < header->summary.samples; i++) {
+        uint32_t encoded;
+        size_t length = session_get_varint(block + offset, end - offset, &encoded);
+        if(length == 0) {
+            return false;
+        }
+        offset += length;
+        value = (int32_t)((uint32_t)value + (uint32_t)session_unzigzag(encoded));
+        values[i] = value;
+    }
+    return offset == end;
+}
+
+/**
+ * Converts a time from the time column to seconds, as Max_Time.m does
+ **/
+static inline double session_seconds(const SessionHeader * header, uint32_t time) {
+    return (double)time * header->tick_cycles / header->cpu_freq;
+}
+
+#endif
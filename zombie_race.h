@@ -0,0 +1,289 @@
+/***********************************************************************************/
+/* Definitions shared between the Teensy game (a2_n9424342.c) and the server       */
+/* (server.c). Both sides are little-endian, so the packed structs below are sent  */
+/* over USB exactly as they are laid out in memory.                                */
+/***********************************************************************************/
+#ifndef ZOMBIE_RACE_H
+#define ZOMBIE_RACE_H
+
+#include <stdint.h>
+
+#ifdef __AVR__
+#include <util/crc16.h>
+#endif
+
+#define PACKED __attribute__((packed))
+
+/**
+ * Commands used for USB communications. Every message starts with one of these bytes.
+ **/
+enum USBCommand {
+    SAVE = 1,
+    LOAD = 2,
+    DEBUG = 3,
+    TELEMETRY = 4,
+    REPLAY = 5
+};
+
+// The number of objects in the game world. The save format depends on them, the benchmarks
+// build the game with other numbers (a save only loads into a game built with the same ones).
+#ifndef NUM_TERRAIN
+#define NUM_TERRAIN         10
+#endif
+#ifndef NUM_HAZARD
+#define NUM_HAZARD          2
+#endif
+// The number of road pieces, one for each row of the LCD
+#define ROAD_LENGTH         48
+// The number of sections of road made ahead of time
+#define ROAD_QUEUE_LENGTH   8
+// The number of random streams (see enum RandomStream in the game)
+#define NUM_RANDOM_STREAMS  4
+// The number of equal parts the race is split into for timing
+#define NUM_SPLITS          4
+
+// The terrain and hazards share one obstacle pool, the terrain first and then the hazards.
+// Each obstacle has a bit in an ObstacleMask.
+#define NUM_OBSTACLES       (NUM_TERRAIN + NUM_HAZARD)
+#if NUM_OBSTACLES > 32
+#error "The obstacle pool can only hold 32 terrain and hazards"
+#elif NUM_OBSTACLES > 16
+typedef uint32_t ObstacleMask;
+#elif NUM_OBSTACLES > 8
+typedef uint16_t ObstacleMask;
+#else
+typedef uint8_t ObstacleMask;
+#endif
+
+/***********************************************************************************/
+/* GAME STATE                                                                      */
+/*                                                                                 */
+/* Everything the game logic changes while a game is played is kept together in a  */
+/* GameState, so a game can be started by copying one in, and saved or restored by */
+/* copying it out and back. Only the game time and the split times are kept       */
+/* outside it, because they come from Timer0.                                      */
+/***********************************************************************************/
+typedef struct PACKED RoadSection {
+    uint8_t direction;
+    uint8_t curve;
+    uint8_t length;
+} RoadSection;
+
+typedef struct PACKED GameState {
+    // Game information
+    uint8_t condition;
+    int16_t fuel;               // Q8.8
+    int32_t speed;              // Q16.16
+    uint16_t scroll_phase;      // The fraction of a pixel scrolled towards the next step, in 1/65536ths
+    uint8_t distance;
+    uint8_t finish_line;
+    uint8_t distance_counter;
+    uint8_t game_over_loss;
+    uint16_t random_state[NUM_RANDOM_STREAMS];
+
+    // Road
+    uint8_t road[ROAD_LENGTH];  // Ring of road pieces, the top of the screen is at road_head
+    uint8_t road_head;
+    uint8_t road_width;
+    uint8_t road_counter;       // Steps since the road last moved horizontally
+    uint8_t road_curve;         // Steps the road takes before each horizontal move
+    uint8_t road_direction;
+    uint8_t road_section_length;    // Steps left in the current section
+    RoadSection road_queue[ROAD_QUEUE_LENGTH];  // Ring of the sections still to come
+    uint8_t road_queue_head;
+    uint8_t road_queue_count;
+    uint8_t road_reserved;      // The length of the straight the fuel station is waiting for (0 for none)
+
+    // The player and the fuel station. The player's car is always the same height up the screen,
+    // and the fuel station stops scrolling once it is just below the screen (LCD_Y+1).
+    uint8_t player_x;
+    uint8_t fuel_station_x;
+    int8_t fuel_station_y;
+    int16_t fuel_station_counter;   // Steps until the fuel station can spawn again
+    uint8_t refuelling;
+
+    // Obstacles
+    uint8_t obstacle_x[NUM_OBSTACLES];
+    int8_t obstacle_y[NUM_OBSTACLES];       // Negative while the obstacle is coming in above the screen
+    uint8_t obstacle_type[NUM_OBSTACLES];   // Index into obstacle_images in the game
+    ObstacleMask obstacle_active;           // Bit i is set if obstacle i is in the game world
+} GameState;
+
+/***********************************************************************************/
+/* SAVE FORMAT                                                                     */
+/*                                                                                 */
+/* A save is sent as the SAVE command, followed by the number of frames, followed  */
+/* by that many frames of SAVE_FRAME_SIZE bytes. The frames hold a SaveImage       */
+/* padded with zeroes.                                                             */
+/***********************************************************************************/
+#define SAVE_MAGIC          0x525A          // "ZR"
+#define SAVE_VERSION        5
+#define SAVE_FRAME_SIZE     32
+
+typedef struct PACKED SaveHeader {
+    uint16_t magic;
+    uint8_t version;
+    uint16_t length;            // The size of the SaveState that follows
+} SaveHeader;
+
+typedef struct PACKED SaveState {
+    GameState game;
+    uint32_t game_timer_counter;        // Timer0 overflows while playing (see Max_Time.m)
+    uint32_t split_ticks[NUM_SPLITS];   // The game time each split was reached in Timer0 ticks, 0 if not yet
+} SaveState;
+
+typedef struct PACKED SaveImage {
+    SaveHeader header;
+    SaveState state;
+    uint16_t crc;               // CRC-CCITT of the header and state
+} SaveImage;
+
+#define SAVE_NUM_FRAMES     ((sizeof(SaveImage) + SAVE_FRAME_SIZE - 1) / SAVE_FRAME_SIZE)
+
+typedef union SaveBuffer {
+    SaveImage image;
+    uint8_t frames[SAVE_NUM_FRAMES][SAVE_FRAME_SIZE];
+} SaveBuffer;
+
+/**
+ * Adds a byte to a CRC-CCITT (0x8408 polynomial, reflected). The Teensy uses the avr-libc
+ * version, the server uses the equivalent C code given in the avr-libc documentation.
+ **/
+#ifdef __AVR__
+#define save_crc_update(crc, data) _crc_ccitt_update(crc, data)
+#else
+static inline uint16_t save_crc_update(uint16_t crc, uint8_t data) {
+    data ^= (uint8_t)(crc & 0xFF);
+    data ^= (uint8_t)(data << 4);
+    return ((((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4) ^ ((uint16_t)data << 3));
+}
+#endif
+
+/**
+ * Calculates the CRC of the header and state of a save
+ **/
+static inline uint16_t save_crc(const SaveImage * image) {
+    const uint8_t * data = (const uint8_t *)image;
+    uint16_t crc = 0xFFFF;
+    for(uint16_t i = 0; i < sizeof(SaveImage) - sizeof(image->crc); i++) {
+        crc = save_crc_update(crc, data[i]);
+    }
+    return crc;
+}
+
+/***********************************************************************************/
+/* TELEMETRY                                                                       */
+/*                                                                                 */
+/* The game samples its state every TELEMETRY_DIVIDER steps and sends the samples  */
+/* in the background as TelemetryMessages of up to TELEMETRY_SAMPLES samples. Only */
+/* the samples that are in use are sent.                                           */
+/***********************************************************************************/
+#define TELEMETRY_SAMPLES   6
+
+typedef struct PACKED TelemetrySample {
+    uint16_t step;              // Counts every game step since the game started
+    uint16_t timer;             // game_timer_counter, the Timer0 overflows while playing (see Max_Time.m)
+    int16_t speed;              // Q8.8
+    int16_t fuel;               // Q8.8
+    uint8_t distance;
+    uint8_t player_x;
+    uint8_t road_x;             // The left edge of the road at the top of the screen
+    uint8_t condition;
+} TelemetrySample;
+
+typedef struct PACKED TelemetryMessage {
+    uint8_t command;            // TELEMETRY
+    uint8_t count;              // The number of samples that follow
+    uint8_t dropped;            // Samples dropped since the last message because the queue was full
+    TelemetrySample samples[TELEMETRY_SAMPLES];
+} TelemetryMessage;
+
+#define TELEMETRY_HEADER_SIZE   (sizeof(TelemetryMessage) - sizeof(TelemetrySample) * TELEMETRY_SAMPLES)
+
+/***********************************************************************************/
+/* PROFILER                                                                        */
+/*                                                                                 */
+/* A game built with PROFILE defined sends a ProfileRecord about once a second as  */
+/* the DEBUG command followed by PROFILE_MARKER (where a text message has its      */
+/* number of lines). All of the times are in microseconds.                         */
+/***********************************************************************************/
+#define PROFILE_MARKER          0xFF
+#define PROFILE_BUCKETS         8
+#define PROFILE_BUCKET_SHIFT    7       // Bucket n counts times under 128 << n us, the last bucket counts the rest
+
+enum ProfilePhase {
+    PROFILE_UPDATE = 0,
+    PROFILE_DRAW = 1,
+    PROFILE_SHOW_SCREEN = 2,    // Part of PROFILE_DRAW
+    PROFILE_ADC = 3,            // Each ADC interrupt, part of whichever phase it interrupted
+    PROFILE_FRAME = 4,          // Everything but waiting for the next frame
+    NUM_PROFILE_PHASES = 5
+};
+
+typedef struct PACKED ProfileStats {
+    uint16_t count;
+    uint16_t min;
+    uint16_t max;
+    uint32_t total;
+    uint16_t histogram[PROFILE_BUCKETS];
+} ProfileStats;
+
+typedef struct PACKED ProfileRecord {
+    uint16_t frames;            // The number of game loop frames in the record
+    uint16_t overruns;          // Frames that took longer than one frame to run
+    ProfileStats phases[NUM_PROFILE_PHASES];
+} ProfileRecord;
+
+/***********************************************************************************/
+/* REPLAY                                                                          */
+/*                                                                                 */
+/* A game built with RECORD defined sends everything the game logic depends on so  */
+/* the game can be replayed by replay.c: the seed when a game starts, the inputs   */
+/* of every update() in REPLAY_INPUT messages of up to REPLAY_FRAMES frames, and a */
+/* checksum of the game state when it ends. The server writes the messages to a    */
+/* file as they are.                                                               */
+/***********************************************************************************/
+#define REPLAY_FRAMES       12
+
+enum ReplayKind {
+    REPLAY_START = 0,
+    REPLAY_INPUT = 1,
+    REPLAY_END = 2
+};
+
+enum ReplayReason {
+    REPLAY_GAME_OVER = 0,       // The game was won or lost
+    REPLAY_LOADED = 1           // A save was loaded, which the replay can't follow
+};
+
+typedef struct PACKED ReplayStart {
+    uint8_t command;            // REPLAY
+    uint8_t kind;               // REPLAY_START
+    uint16_t seed;              // What the random streams were seeded with
+} ReplayStart;
+
+typedef struct PACKED ReplayFrame {
+    uint8_t held;               // controls_held, one bit for each control
+    uint8_t pressed;            // controls_pressed
+    uint16_t pot;               // The speed pot (adc_value(0))
+    uint8_t ticks;              // Timer1 ticks since the last update()
+} ReplayFrame;
+
+typedef struct PACKED ReplayInput {
+    uint8_t command;            // REPLAY
+    uint8_t kind;               // REPLAY_INPUT
+    uint8_t count;              // The number of frames that follow
+    ReplayFrame frames[REPLAY_FRAMES];
+} ReplayInput;
+
+#define REPLAY_INPUT_HEADER_SIZE    (sizeof(ReplayInput) - sizeof(ReplayFrame) * REPLAY_FRAMES)
+
+typedef struct PACKED ReplayEnd {
+    uint8_t command;            // REPLAY
+    uint8_t kind;               // REPLAY_END
+    uint8_t reason;
+    uint32_t frames;            // The number of frames in the replay
+    uint16_t checksum;          // CRC of the GameState at the end
+} ReplayEnd;
+
+#endif